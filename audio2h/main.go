@@ -1,6 +1,9 @@
 package main
 
 import (
+	"crypto/sha256"
+	"encoding/binary"
+	"encoding/hex"
 	"encoding/json"
 	"flag"
 	"fmt"
@@ -10,7 +13,12 @@ import (
 	"os/exec"
 	"path"
 	"path/filepath"
+	"regexp"
+	"runtime"
+	"strconv"
 	"strings"
+	"sync"
+	"sync/atomic"
 
 	log "github.com/schollz/logger"
 	"github.com/schollz/sox"
@@ -25,15 +33,25 @@ var flagBPM float64
 var flagSR float64
 var fileOrdering []string
 var flagIgnoreFileList bool
+var flagDetect bool
+var flagJobs int
+var flagUF2 string
+var flagBankOffset int
+var flagFlashSize int
 
 func init() {
 	flag.StringVar(&flagFileList, "list", "", "list of files to use")
 	flag.StringVar(&flagFolder, "folder-in", "flacs", "folder for finding audio")
 	flag.StringVar(&flagFolderOut, "folder-out", "converted", "folder for placing converted files")
 	flag.IntVar(&flagLimit, "limit", 100, "limit number of samples")
-	flag.Float64Var(&flagBPM, "bpm", 165, "bpm to set to")
+	flag.Float64Var(&flagBPM, "bpm", 165, "bpm every file is stretched to")
 	flag.Float64Var(&flagSR, "sr", 33000, "sample rate to set to")
 	flag.BoolVar(&flagIgnoreFileList, "ignore-filelist", false, "ignore the file list")
+	flag.IntVar(&flagJobs, "jobs", runtime.NumCPU(), "number of files to convert at once")
+	flag.BoolVar(&flagDetect, "detect", false, "estimate tempo from the audio even if the filename has one")
+	flag.StringVar(&flagUF2, "uf2", "", "also write a samples-only uf2 for the sample partition")
+	flag.IntVar(&flagBankOffset, "bank-offset", 1024*1024, "flash offset of the sample partition (SAMPLE_BANK_OFFSET)")
+	flag.IntVar(&flagFlashSize, "flash-size", 16*1024*1024, "flash size of the board (PICO_FLASH_SIZE_BYTES)")
 
 	if !flagIgnoreFileList {
 		b, err := os.ReadFile("jsons/filelist2.txt")
@@ -46,6 +64,12 @@ func init() {
 func main() {
 	flag.Parse()
 	log.SetLevel("trace")
+	// the firmware steps every sample at one tempo (SAMPLES_PER_BEAT), so
+	// the files have to share it
+	if flagBPM <= 0 {
+		log.Error("--bpm must be above 0")
+		os.Exit(1)
+	}
 	files, err := getFiles(flagFolder)
 	if err != nil {
 		return
@@ -92,15 +116,13 @@ func audio2h(files []File) (err error) {
 	fb.Close()
 
 	var sb strings.Builder
-	var sbd strings.Builder
 	limit := len(files)
 	if limit > flagLimit {
 		limit = flagLimit
 	}
-	sb.WriteString("#include <pico/platform.h>\n\n")
+	sb.WriteString("#include <stdint.h>\n\n")
 	sb.WriteString(fmt.Sprintf("#define SAMPLE_RATE %d\n", int(flagSR)))
-	sb.WriteString(fmt.Sprintf("#define BPM_SAMPLED %d\n", int(flagBPM)))
-	sb.WriteString(fmt.Sprintf("#define NUM_SAMPLES %d\n", limit))
+	sb.WriteString(fmt.Sprintf("#define BPM_SAMPLED %d\n", int(math.Round(flagBPM))))
 	samplesPerBeat := math.Round(60 / flagBPM * flagSR / 2)
 	sb.WriteString(fmt.Sprintf("#define SAMPLES_PER_BEAT %d\n", int(samplesPerBeat)))
 	retrigMults := []float64{4, 3.66666666, 3, 2.666666, 2.5, 2, 1.5, 1.333333333, 1, 0.75, 0.666666666, 0.5, 0.5 * 0.75, 0.333333, 0.25, 0.25 * 0.75, 0.125, 0.125 * 0.75, 0.0625}
@@ -109,22 +131,17 @@ func audio2h(files []File) (err error) {
 		retrigs[i] = fmt.Sprintf("%d", int(math.Round(samplesPerBeat*v)))
 	}
 	sb.WriteString(fmt.Sprintf("#define NUM_RETRIGS %d\n", len(retrigs)))
-	sb.WriteString("const uint16_t retrigs[] = { " + strings.Join(retrigs, ", ") + " };")
-
-	sampleStart := 0
-	silentBytes := 65536 * 2
-	sb.WriteString("\n\n// filename: dummy\n")
-	sb.WriteString(fmt.Sprintf("#define RAW_DUMMY_BEATS 1\n"))
-	sb.WriteString(fmt.Sprintf("#define RAW_DUMMY_SAMPLES %d\n", silentBytes))
-	sb.WriteString(fmt.Sprintf("#define RAW_DUMMY_START %d\n", sampleStart))
-	sampleStart += silentBytes
-	sbd.WriteString(fmt.Sprintf("const uint8_t __in_flash() raw_audio[] = {\n"))
-	intsDummy := make([]int, silentBytes)
-	for i, _ := range intsDummy {
-		intsDummy[i] = 128
-	}
-	sbd.WriteString(printInts(intsDummy))
+	// the audio interrupt reads the table every sample, it is kept in RAM
+	sb.WriteString("const uint16_t __not_in_flash(\"audio_tables\") retrigs[] = { " + strings.Join(retrigs, ", ") + " };\n\n")
+
+	// the samples go into a bank image (see doth/sample_bank.h) that
+	// doth/audio2h.S links into the firmware, and optionally into a
+	// samples-only UF2 for the sample partition
+	var samples []bankSample
 	for i, f := range files {
+		if i == limit {
+			break
+		}
 		var ints []int
 		ints, err = convertWavToInts(f.Converted)
 		if err != nil {
@@ -132,71 +149,144 @@ func audio2h(files []File) (err error) {
 			return
 		}
 		log.Tracef("[%3d] %s: %d", f.Order, f.Converted, len(ints))
-		sb.WriteString("\n\n// filename: " + filepath.Base(f.Pathname) + "\n")
-		sb.WriteString(fmt.Sprintf("#define RAW_%d_BEATS %d\n", i, int(f.Beats)*2))
-		sb.WriteString(fmt.Sprintf("#define RAW_%d_SAMPLES %d\n", i, len(ints)))
-		sb.WriteString(fmt.Sprintf("#define RAW_%d_START %d\n", i, sampleStart))
-		sampleStart += len(ints)
-		sbd.WriteString("\n,\n")
-		sbd.WriteString(printInts(ints))
-
-		if i == limit {
-			break
-		}
+		beats := int(f.Beats) * 2
+		samples = append(samples, bankSample{
+			data:   intsToBytes(ints),
+			beats:  beats,
+			slices: detectSlices(ints, beats, f.samplesPerBeat(), f.Downbeat, int(flagSR)),
+		})
 	}
-	sbd.WriteString("};\n\n")
-	sb.WriteString("\n\n")
-	sb.WriteString(sbd.String())
-
-	sb.WriteString("char raw_val(int s, int i) {\n")
-	for i := range files {
-		sb.WriteString(fmt.Sprintf("\tif (s==%d) return raw_audio[i+RAW_%d_START];\n", i, i))
-		if i == limit {
-			break
-		}
+	bank := makeBank(samples, int(samplesPerBeat), int(flagSR))
+	err = os.WriteFile("../doth/audio2h.bin", bank, 0644)
+	if err != nil {
+		log.Error(err)
+		return
 	}
-	sb.WriteString("return raw_audio[i];\n}\n\n")
-
-	sb.WriteString("unsigned int raw_len(int s) {\n")
-	for i := range files {
-		sb.WriteString(fmt.Sprintf("\tif (s==%d) return RAW_%d_SAMPLES;\n", i, i))
-		if i == limit {
-			break
+	if flagUF2 != "" {
+		// the partition ends where the settings journal starts, the last
+		// 16 KB of flash (SETTINGS_OFFSET)
+		partition := flagFlashSize - settingsRegionSize - flagBankOffset
+		if len(bank) > partition {
+			err = fmt.Errorf("bank is %d bytes, the sample partition holds %d", len(bank), partition)
+			log.Error(err)
+			return
 		}
-	}
-	sb.WriteString("return RAW_0_SAMPLES;\n}\n\n")
-
-	sb.WriteString("unsigned int raw_beats(int s) {\n")
-	for i := range files {
-		sb.WriteString(fmt.Sprintf("\tif (s==%d) return RAW_%d_BEATS;\n", i, i))
-		if i == limit {
-			break
+		err = os.WriteFile(flagUF2, makeUF2(bank, uint32(flagBankOffset)), 0644)
+		if err != nil {
+			log.Error(err)
+			return
 		}
+		log.Infof("wrote %s (%d samples, %d bytes at offset %d)", flagUF2, len(samples), len(bank), flagBankOffset)
 	}
-	sb.WriteString("return 1;\n}\n\n")
+
+	sb.WriteString("// linked from audio2h.bin by doth/audio2h.S when SAMPLE_BANK_LINKED=1\n")
+	sb.WriteString("extern const uint8_t raw_audio[];\n")
 
 	f, err := os.Create("../doth/audio2h.h")
+	if err != nil {
+		log.Error(err)
+		return
+	}
 	f.WriteString(sb.String())
 	f.Close()
 	return
 }
 
-func printInts(ints []int) (s string) {
-	var sb strings.Builder
-	sb.WriteString("\t")
+func intsToBytes(ints []int) (b []byte) {
+	b = make([]byte, len(ints))
 	for i, v := range ints {
-		sb.WriteString(fmt.Sprintf("0x%02x", v))
-		if i < len(ints)-1 {
-			sb.WriteString(", ")
-		}
-		if i > 0 && i%20 == 0 {
-			sb.WriteString("\n\t")
-		}
+		b[i] = byte(v)
+	}
+	return
+}
 
+const (
+	bankMagic   = 0x42534B50 // "PKSB"
+	bankVersion = 4
+	bankHeader  = 16
+	bankEntry   = 20
+
+	settingsRegionSize = 16 * 1024 // SETTINGS_REGION_SIZE
+)
+
+type bankSample struct {
+	data   []byte
+	beats  int   // eighth notes
+	slices []int // start of each beat, from detectSlices
+}
+
+// makeBank lays out a sample bank image as read by doth/sample_bank.h:
+// header, directory, slice tables, then the audio
+func makeBank(samples []bankSample, samplesPerBeat int, sampleRate int) (b []byte) {
+	slicesStart := bankHeader + bankEntry*len(samples)
+	dataStart := slicesStart
+	for _, s := range samples {
+		dataStart += 4 * len(s.slices)
+	}
+	size := dataStart
+	for _, s := range samples {
+		size += len(s.data)
+	}
+	b = make([]byte, size)
+	binary.LittleEndian.PutUint32(b[0:], bankMagic)
+	binary.LittleEndian.PutUint16(b[4:], bankVersion)
+	binary.LittleEndian.PutUint16(b[6:], uint16(len(samples)))
+	binary.LittleEndian.PutUint32(b[8:], uint32(samplesPerBeat))
+	binary.LittleEndian.PutUint32(b[12:], uint32(size))
+	slices := slicesStart
+	offset := dataStart
+	for i, s := range samples {
+		e := b[bankHeader+bankEntry*i:]
+		binary.LittleEndian.PutUint32(e[0:], uint32(offset))
+		binary.LittleEndian.PutUint32(e[4:], uint32(len(s.data)))
+		binary.LittleEndian.PutUint32(e[8:], uint32(sampleRate))
+		binary.LittleEndian.PutUint16(e[12:], uint16(s.beats))
+		if len(s.slices) == s.beats {
+			binary.LittleEndian.PutUint32(e[16:], uint32(slices))
+			for _, v := range s.slices {
+				binary.LittleEndian.PutUint32(b[slices:], uint32(v))
+				slices += 4
+			}
+		}
+		copy(b[offset:], s.data)
+		offset += len(s.data)
 	}
-	s = sb.String()
 	return
+}
 
+const (
+	uf2MagicStart0  = 0x0A324655
+	uf2MagicStart1  = 0x9E5D5157
+	uf2MagicEnd     = 0x0AB16F30
+	uf2FlagFamily   = 0x00002000
+	uf2FamilyRP2040 = 0xE48BFF56
+	uf2Payload      = 256
+	xipBase         = 0x10000000
+)
+
+// makeUF2 wraps data into a UF2 that the RP2040 bootloader writes to flash
+// at offset, leaving the firmware alone
+func makeUF2(data []byte, offset uint32) (b []byte) {
+	numBlocks := (len(data) + uf2Payload - 1) / uf2Payload
+	b = make([]byte, 512*numBlocks)
+	for i := 0; i < numBlocks; i++ {
+		block := b[512*i : 512*(i+1)]
+		binary.LittleEndian.PutUint32(block[0:], uf2MagicStart0)
+		binary.LittleEndian.PutUint32(block[4:], uf2MagicStart1)
+		binary.LittleEndian.PutUint32(block[8:], uf2FlagFamily)
+		binary.LittleEndian.PutUint32(block[12:], xipBase+offset+uint32(i*uf2Payload))
+		binary.LittleEndian.PutUint32(block[16:], uf2Payload)
+		binary.LittleEndian.PutUint32(block[20:], uint32(i))
+		binary.LittleEndian.PutUint32(block[24:], uint32(numBlocks))
+		binary.LittleEndian.PutUint32(block[28:], uf2FamilyRP2040)
+		end := (i + 1) * uf2Payload
+		if end > len(data) {
+			end = len(data)
+		}
+		copy(block[32:], data[i*uf2Payload:end])
+		binary.LittleEndian.PutUint32(block[508:], uf2MagicEnd)
+	}
+	return
 }
 
 type File struct {
@@ -206,6 +296,31 @@ type File struct {
 	BPM       float64
 	Order     int
 	Seconds   float64
+	Detect    bool // tempo not in the filename, estimated from the audio
+	Downbeat  int  // first beat, in samples of the converted audio
+}
+
+// samplesPerBeat is the length of an eighth note in the converted audio
+func (f File) samplesPerBeat() int {
+	return int(math.Round(60 / flagBPM * flagSR / 2))
+}
+
+var beatsRegexp = regexp.MustCompile(`beats(\d+\.?\d*)`)
+var bpmRegexp = regexp.MustCompile(`bpm(\d+\.?\d*)`)
+
+// tempoFromName reads the tempo from a filename like
+// amen_5c2d11c8_beats16_bpm170.flac
+func tempoFromName(fname string) (beats float64, bpm float64, ok bool) {
+	base := strings.ToLower(filepath.Base(fname))
+	mBeats := beatsRegexp.FindStringSubmatch(base)
+	mBPM := bpmRegexp.FindStringSubmatch(base)
+	if mBeats == nil || mBPM == nil {
+		return
+	}
+	beats, _ = strconv.ParseFloat(mBeats[1], 64)
+	bpm, _ = strconv.ParseFloat(mBPM[1], 64)
+	ok = beats > 0 && bpm > 0
+	return
 }
 
 func getFiles(folderName string) (files []File, err error) {
@@ -248,15 +363,9 @@ func getFiles(folderName string) (files []File, err error) {
 	i := 0
 	for _, fname := range fnames {
 		files[i].Pathname = fname
-		files[i].Converted = path.Join(flagFolderOut, filepath.Base(fname)+".wav")
-		files[i].Beats, files[i].BPM, err = sox.GetBPM(fname)
-		if err != nil {
-			log.Error(err)
-		}
-		files[i].Seconds, err = sox.Length(fname)
-		if err != nil {
-			log.Error(err)
-		}
+		var ok bool
+		files[i].Beats, files[i].BPM, ok = tempoFromName(fname)
+		files[i].Detect = !ok || flagDetect
 		log.Tracef("0: %+v", files[i])
 		i++
 		if i == flagLimit {
@@ -267,23 +376,117 @@ func getFiles(folderName string) (files []File, err error) {
 	return
 }
 
+// conversionVersion is part of the cache key, bump it when convertFile or
+// estimateTempo change their output
+const conversionVersion = 1
+
+// cacheKey hashes the input audio together with everything that changes its
+// conversion, so an unchanged file at unchanged settings is converted once
+func cacheKey(f File) (key string, err error) {
+	fi, err := os.Open(f.Pathname)
+	if err != nil {
+		return
+	}
+	defer fi.Close()
+	h := sha256.New()
+	if _, err = io.Copy(h, fi); err != nil {
+		return
+	}
+	fmt.Fprintf(h, "%s v%d sr%d bpm%2.6f detect%v beats%2.6f srcbpm%2.6f", f.Pathname, conversionVersion, int(flagSR), flagBPM, f.Detect, f.Beats, f.BPM)
+	key = hex.EncodeToString(h.Sum(nil))[:16]
+	return
+}
+
+// convertFiles converts files on a pool of --jobs workers. Each result is
+// cached in the output folder as a wav plus a json with the tempo analysis,
+// the json being written last so an interrupted conversion is redone.
 func convertFiles(files []File) (err error) {
-	os.RemoveAll(flagFolderOut)
 	os.MkdirAll(flagFolderOut, os.ModePerm)
-	for _, f := range files {
-		lpf := int(flagSR*7/16) - 5
-		if lpf > 19000 {
-			lpf = 19000
+	jobs := make(chan int)
+	var wg sync.WaitGroup
+	var converted, cached int32
+	for w := 0; w < flagJobs || w == 0; w++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for i := range jobs {
+				if convertCached(&files[i]) {
+					atomic.AddInt32(&cached, 1)
+				} else {
+					atomic.AddInt32(&converted, 1)
+				}
+			}
+		}()
+	}
+	for i := range files {
+		jobs <- i
+	}
+	close(jobs)
+	wg.Wait()
+	log.Infof("converted %d files, %d from cache", converted, cached)
+	return
+}
+
+// convertCached fills in f.Converted and the tempo, returning true if both
+// came from the cache
+func convertCached(f *File) bool {
+	key, err := cacheKey(*f)
+	if err != nil {
+		log.Error(err)
+		return false
+	}
+	base := path.Join(flagFolderOut, filepath.Base(f.Pathname)+"."+key)
+	f.Converted = base + ".wav"
+	if b, err := os.ReadFile(base + ".json"); err == nil {
+		if _, err := os.Stat(f.Converted); err == nil && json.Unmarshal(b, f) == nil {
+			return true
 		}
-		log.Tracef("%s", strings.Join([]string{"sox", f.Pathname, "-r", fmt.Sprint(int(flagSR)), "-c", "1", "-b", "8", f.Converted, "speed", fmt.Sprintf("%2.6f", flagBPM/f.BPM), "lowpass", fmt.Sprint(lpf), "norm", "gain", "-6"}, " "))
-		cmd := exec.Command("sox", f.Pathname, "-r", fmt.Sprint(int(flagSR)), "-c", "1", "-b", "8", f.Converted, "speed", fmt.Sprintf("%2.6f", flagBPM/f.BPM), "highpass", "5", "lowpass", fmt.Sprint(lpf), "gain", "-6", "norm", "-3", "dither")
-		stdoutStderr, err := cmd.CombinedOutput()
+	}
+	convertTempo(f)
+	b, err := json.Marshal(f)
+	if err == nil {
+		err = os.WriteFile(base+".json.tmp", b, 0644)
+	}
+	if err == nil {
+		err = os.Rename(base+".json.tmp", base+".json")
+	}
+	if err != nil {
+		log.Error(err)
+	}
+	return false
+}
+
+func convertTempo(f *File) {
+	f.Seconds, _ = sox.Length(f.Pathname)
+	if f.Detect {
+		// analyse the file at its own tempo first
+		convertFile(*f, 1)
+		ints, err := convertWavToInts(f.Converted)
 		if err != nil {
-			log.Errorf("cmd failed: \n%s", stdoutStderr)
+			log.Error(err)
+			return
 		}
+		f.Beats, f.BPM, f.Downbeat = estimateTempo(ints, int(flagSR))
+		log.Infof("%s: estimated %2.0f beats at %2.1f bpm, downbeat at %d", filepath.Base(f.Pathname), f.Beats, f.BPM, f.Downbeat)
+	}
+	speed := flagBPM / f.BPM
+	if !f.Detect || speed != 1 {
+		convertFile(*f, speed)
+		f.Downbeat = int(float64(f.Downbeat) / speed)
+	}
+}
+
+func convertFile(f File, speed float64) {
+	lpf := int(flagSR*7/16) - 5
+	if lpf > 19000 {
+		lpf = 19000
+	}
+	log.Tracef("%s", strings.Join([]string{"sox", f.Pathname, "-r", fmt.Sprint(int(flagSR)), "-c", "1", "-b", "8", f.Converted, "speed", fmt.Sprintf("%2.6f", speed), "lowpass", fmt.Sprint(lpf), "norm", "gain", "-6"}, " "))
+	cmd := exec.Command("sox", f.Pathname, "-r", fmt.Sprint(int(flagSR)), "-c", "1", "-b", "8", f.Converted, "speed", fmt.Sprintf("%2.6f", speed), "highpass", "5", "lowpass", fmt.Sprint(lpf), "gain", "-6", "norm", "-3", "dither")
+	stdoutStderr, err := cmd.CombinedOutput()
+	if err != nil {
+		log.Errorf("cmd failed: \n%s", stdoutStderr)
 	}
-	err = nil
-	return
 }
 
 func ex(c string) (err error) {
@@ -303,23 +506,18 @@ func convertWavToInts(fname string) (vals []int, err error) {
 		return
 	}
 	reader := wav.NewReader(file)
-	n := 0
-	vals = make([]int, 10000000)
+	vals = make([]int, 0, 1<<20)
 	for {
 		samples, err := reader.ReadSamples()
 
 		for _, sample := range samples {
-			v := reader.IntValue(sample, 0)
-			vals[n] = v
-			n++
+			vals = append(vals, reader.IntValue(sample, 0))
 		}
 
-		if err == io.EOF {
+		if err != nil {
 			break
 		}
 	}
 	err = file.Close()
-
-	vals = vals[:n]
 	return
 }
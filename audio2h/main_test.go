@@ -17,12 +17,72 @@ func TestGuessBPM(t *testing.T) {
 	tests := []test{
 		{"flacs/cold_sweat_bpm150_beats16.flac", 16, 150},
 		{"flacs/amen_5c063f57_beats8_bpm146.flac", 8, 146},
+		// no tempo in the name, estimated from a loop of 4 beats at 160
 		{"test.flac", 4, 160},
 	}
+	sr := 48000
 	for _, tc := range tests {
-		beats, bpm, err := determineBeats(tc.fname)
-		assert.Nil(t, err)
-		assert.Equal(t, tc.bpm, bpm)
+		beats, bpm, ok := tempoFromName(tc.fname)
+		if !ok {
+			beats, bpm, _ = estimateTempo(clickLoop(160, 4, sr), sr)
+		}
 		assert.Equal(t, tc.beats, beats)
+		assert.InDelta(t, tc.bpm, bpm, 0.5)
+	}
+}
+
+// clickLoop is a loop of quarter note hits with quieter offbeats
+func clickLoop(bpm float64, beats int, sr int) []int {
+	spb := int(60 / bpm * float64(sr))
+	vals := make([]int, spb*beats)
+	for i := range vals {
+		vals[i] = 128
+	}
+	for b := 0; b < beats*2; b++ {
+		amp := 100
+		if b%2 == 1 {
+			amp = 30
+		}
+		h := b * spb / 2
+		for i := 0; i < 1500 && h+i < len(vals); i++ {
+			vals[h+i] = 128 + (1-2*(i%2))*amp*(1500-i)/1500
+		}
+	}
+	return vals
+}
+
+func TestDetectSlices(t *testing.T) {
+	sr, spb, beats := 48000, 8727, 8
+	vals := make([]int, spb*beats)
+	for i := range vals {
+		vals[i] = 128
+	}
+	// one decaying hit per beat, early or late by up to 10 ms, none on beat 3
+	hits := []int{0, spb + 400, 2*spb - 450, -1, 4*spb + 100, 5*spb - 200, 6 * spb, 7*spb + 480}
+	for _, h := range hits {
+		for i := 0; h >= 0 && i < 2000; i++ {
+			vals[h+i] = 128 + (1-2*(i%2))*100*(2000-i)/2000
+		}
+	}
+	slices := detectSlices(vals, beats, spb, 0, sr)
+	for b, h := range hits {
+		if h < 0 {
+			assert.Equal(t, b*spb, slices[b])
+			continue
+		}
+		// slices land just before the hit
+		assert.True(t, slices[b] <= h && h-slices[b] < sr*8/1000, "beat %d: slice %d hit %d", b, slices[b], h)
+	}
+}
+
+func TestEstimateTempo(t *testing.T) {
+	sr := 48000
+	for _, bpm := range []float64{92, 140, 160} {
+		// two bars
+		vals := clickLoop(bpm, 8, sr)
+		beats, estimated, downbeat := estimateTempo(vals, sr)
+		assert.Equal(t, 8.0, beats)
+		assert.InDelta(t, bpm, estimated, 0.5)
+		assert.True(t, downbeat < sr/100, "%v bpm: downbeat %d", bpm, downbeat)
 	}
 }
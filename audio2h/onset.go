@@ -0,0 +1,172 @@
+package main
+
+import "math"
+
+// onset detection on the converted 8-bit audio. The envelope is the rise in
+// RMS level between short frames, which is cheap, keeps accents louder than
+// ghost notes, and picks out drum hits well enough to line slices up with
+// them.
+
+const onsetHopMs = 2
+const onsetSearchMs = 30
+
+// onsetEnvelope returns the positive RMS flux per hop of the samples
+func onsetEnvelope(vals []int, hop int) (env []float64) {
+	frames := len(vals) / hop
+	env = make([]float64, frames)
+	last := 0.0
+	for k := 0; k < frames; k++ {
+		energy := 0.0
+		n := 0
+		for i := k * hop; i < (k+2)*hop && i < len(vals); i++ {
+			v := float64(vals[i] - 128)
+			energy += v * v
+			n++
+		}
+		e := math.Sqrt(energy / float64(n))
+		if e > last {
+			env[k] = e - last
+		}
+		last = e
+	}
+	return
+}
+
+// detectSlices returns where each beat starts, moving every grid position
+// (from start, samplesPerBeat apart) to the strongest onset within
+// onsetSearchMs of it. Beats without a clear onset stay on the grid. Slices
+// start one hop before the onset so the crossfade into a head has finished
+// by the time the transient plays.
+func detectSlices(vals []int, beats int, samplesPerBeat int, start int, sampleRate int) (slices []int) {
+	slices = make([]int, beats)
+	hop := sampleRate * onsetHopMs / 1000
+	if hop < 1 {
+		hop = 1
+	}
+	env := onsetEnvelope(vals, hop)
+	mean, std := meanStd(env)
+	thresh := mean + 2*std
+
+	search := sampleRate * onsetSearchMs / 1000 / hop
+	if search > samplesPerBeat/3/hop {
+		search = samplesPerBeat / 3 / hop
+	}
+	for i := range slices {
+		grid := start + i*samplesPerBeat
+		slices[i] = grid
+		if len(vals) > 0 && grid >= len(vals) {
+			slices[i] = grid % len(vals)
+			continue
+		}
+		best := -1
+		center := grid / hop
+		for k := center - search; k <= center+search; k++ {
+			if k < 1 || k >= len(env)-1 {
+				continue
+			}
+			if env[k] < thresh || env[k] < env[k-1] || env[k] < env[k+1] {
+				continue
+			}
+			if best < 0 || env[k] > env[best] {
+				best = k
+			}
+		}
+		if best < 0 {
+			continue
+		}
+		pos := (best - 1) * hop
+		if pos < 0 {
+			pos = 0
+		}
+		if i > 0 && pos <= slices[i-1] {
+			continue
+		}
+		slices[i] = pos
+	}
+	return
+}
+
+const tempoMin = 60.0
+const tempoMax = 200.0
+const tempoPrior = 140.0 // breaks sit around here, so octave errors lean to it
+
+// estimateTempo finds the tempo of a loop from the autocorrelation of its
+// onset envelope, weighted towards tempoPrior (one octave wide) so that half
+// and double tempos lose. The loop is assumed to hold a whole number of beats,
+// which refines the estimate. The downbeat is the phase of the beat grid that
+// lines up with the most onset energy, in samples from the start.
+func estimateTempo(vals []int, sampleRate int) (beats float64, bpm float64, downbeat int) {
+	seconds := float64(len(vals)) / float64(sampleRate)
+	hop := sampleRate * onsetHopMs / 1000
+	raw := onsetEnvelope(vals, hop)
+	// smoothed so that beat periods that are not a whole number of hops
+	// still line up with themselves
+	env := make([]float64, len(raw))
+	for k := range raw {
+		for j := k - 2; j <= k+2; j++ {
+			if j >= 0 && j < len(raw) {
+				env[k] += raw[j]
+			}
+		}
+	}
+	mean, _ := meanStd(env)
+	hopsPerSecond := float64(sampleRate) / float64(hop)
+
+	best, bestScore := 0, 0.0
+	for lag := int(hopsPerSecond * 60 / tempoMax); lag <= int(hopsPerSecond*60/tempoMin) && lag < len(env); lag++ {
+		score := 0.0
+		for k := lag; k < len(env); k++ {
+			score += (env[k] - mean) * (env[k-lag] - mean)
+		}
+		score /= float64(len(env) - lag)
+		octaves := math.Log2(60 * hopsPerSecond / float64(lag) / tempoPrior)
+		score *= math.Exp(-0.5 * octaves * octaves)
+		if score > bestScore {
+			best, bestScore = lag, score
+		}
+	}
+	if best == 0 {
+		// too short or no onsets, same default as a bare filename
+		beats, bpm = 4, 160
+		return
+	}
+	bpm = 60 * hopsPerSecond / float64(best)
+	beats = math.Max(1, math.Round(seconds*bpm/60))
+	bpm = 60 * beats / seconds
+
+	period := hopsPerSecond * 60 / bpm
+	bestPhase, bestSum := 0, -1.0
+	for phase := 0; phase < int(period); phase++ {
+		sum := 0.0
+		for k := float64(phase); int(k) < len(env); k += period {
+			sum += env[int(k)]
+		}
+		if sum > bestSum {
+			bestPhase, bestSum = phase, sum
+		}
+	}
+	// a loop cut just after the beat wraps back to the start
+	if float64(bestPhase) > period*3/4 {
+		bestPhase = 0
+	}
+	downbeat = (bestPhase - 1) * hop
+	if downbeat < 0 {
+		downbeat = 0
+	}
+	return
+}
+
+func meanStd(x []float64) (mean float64, std float64) {
+	if len(x) == 0 {
+		return
+	}
+	for _, v := range x {
+		mean += v
+	}
+	mean /= float64(len(x))
+	for _, v := range x {
+		std += (v - mean) * (v - mean)
+	}
+	std = math.Sqrt(std / float64(len(x)))
+	return
+}
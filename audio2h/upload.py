@@ -0,0 +1,63 @@
+# uploads a sample bank (doth/audio2h.bin) to the sample partition of a
+# running pikocore over its USB vendor interface, see doth/sample_upload.h
+#
+# usage: python3 upload.py ../doth/audio2h.bin
+
+import struct
+import sys
+import time
+
+import usb.core
+import usb.util
+
+VID = 0xCAFE
+MAGIC = 0x50554B50  # "PKUP"
+STATUS = {0: "ok", 1: "bank does not fit in the sample partition", 2: "bank is not valid"}
+
+
+def find_vendor_endpoints(dev):
+    cfg = dev.get_active_configuration()
+    for intf in cfg:
+        if intf.bInterfaceClass != 0xFF:
+            continue
+        ep_out = usb.util.find_descriptor(
+            intf,
+            custom_match=lambda e: usb.util.endpoint_direction(e.bEndpointAddress)
+            == usb.util.ENDPOINT_OUT,
+        )
+        ep_in = usb.util.find_descriptor(
+            intf,
+            custom_match=lambda e: usb.util.endpoint_direction(e.bEndpointAddress)
+            == usb.util.ENDPOINT_IN,
+        )
+        return intf, ep_out, ep_in
+    return None, None, None
+
+
+def main():
+    bank = open(sys.argv[1], "rb").read()
+    dev = usb.core.find(idVendor=VID)
+    if dev is None:
+        sys.exit("no pikocore found")
+    intf, ep_out, ep_in = find_vendor_endpoints(dev)
+    if intf is None:
+        sys.exit("pikocore firmware was built without SAMPLE_UPLOAD_ENABLED")
+    usb.util.claim_interface(dev, intf)
+
+    start = time.time()
+    ep_out.write(struct.pack("<II", MAGIC, len(bank)))
+    for i in range(0, len(bank), 4096):
+        # the device NAKs while it erases, so allow for slow flash
+        ep_out.write(bank[i : i + 4096], timeout=5000)
+    magic, status, kbps = struct.unpack("<III", bytes(ep_in.read(12, timeout=10000)))
+    if magic != MAGIC:
+        sys.exit("bad reply from pikocore")
+    print(
+        "%s: %d bytes in %.1f s (device: %d KB/s)"
+        % (STATUS.get(status, status), len(bank), time.time() - start, kbps)
+    )
+    sys.exit(0 if status == 0 else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -57,8 +57,9 @@ q = 0.707 * 2.5
 notes = list(range(76, 122))
 print(f"// Sample rate: {sample_rate} Hz")
 print(f"#define LPF_MAX {len(notes)-1}")
-print("int32_t x1_f, x2_f, y1_f, y2_f;")
-print("uint8_t filter_lpf(int32_t x, int32_t f_, uint8_t q) {")
+# the filters run in the audio interrupt, from RAM with their state in scratch X
+print('int32_t __scratch_x("audio") x1_f, x2_f, y1_f, y2_f;')
+print("uint8_t __not_in_flash_func(filter_lpf)(int32_t x, int32_t f_, uint8_t q) {")
 print("  int32_t y;")
 print(
     """uint8_t f = f_;
@@ -100,8 +101,8 @@ q = 0.707 * 1
 ROUNDER = 20
 notes = list(range(80, 130))
 print(f"#define HPF_MAX {len(notes)-1}")
-print("int32_t xh1_f, xh2_f, yh1_f, yh2_f;")
-print("uint8_t filter_hpf(int32_t x, uint8_t f, uint8_t q) {")
+print('int32_t __scratch_x("audio") xh1_f, xh2_f, yh1_f, yh2_f;')
+print("uint8_t __not_in_flash_func(filter_hpf)(int32_t x, uint8_t f, uint8_t q) {")
 print("  int32_t y;")
 print("  if (f>HPF_MAX) f=HPF_MAX;")
 for i, note in enumerate(notes):
@@ -17,7 +17,7 @@ class Button {
     val[1] = (bool)(1 - gpio_get(gpio));
   }
 
-  bool On() { return val[0]; }
+  bool __not_in_flash_func(On)() { return val[0]; }
 
   void Set(bool v) {
     val[0] = v;
@@ -0,0 +1,97 @@
+// ClockIn - edge capture for the clock and reset inputs
+//
+// A GPIO interrupt stores time_us_64() of every active edge in a ring
+// buffer, so pulses are timed to the microsecond (well under one sample at
+// 48 kHz) however late the main loop gets to them. The interrupt runs at the
+// highest priority so the audio timer cannot delay the timestamp. The main
+// loop drains the ring with Next():
+//
+//   ClockIn clock_in;
+//   clock_in.Init(CLOCK_IN_PIN);
+//
+//   uint64_t edge_us;
+//   while (clock_in.Next(edge_us)) {
+//     ...
+//   }
+//
+// Edges closer than CLOCK_IN_HOLDOFF_US to the previous one are bounces and
+// are dropped, and so are edges that arrive while the ring is full.
+
+#ifndef CLOCK_IN_H
+#define CLOCK_IN_H
+
+#include <stdint.h>
+
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/timer.h"
+
+#define CLOCK_IN_EDGES 16         // power of two
+#define CLOCK_IN_HOLDOFF_US 2000  // shortest time between two pulses
+
+class ClockIn {
+  uint8_t gpio;
+  volatile uint64_t edges[CLOCK_IN_EDGES];
+  volatile uint8_t head;  // written by the interrupt
+  volatile uint8_t tail;  // written by Next()
+  uint64_t last_us;       // last edge seen, dropped or not
+  uint32_t dropped;
+
+  static inline ClockIn *by_gpio[30] = {nullptr};
+
+  static void Callback(uint gpio, uint32_t events) {
+    uint64_t now = time_us_64();
+    if (gpio < 30 && by_gpio[gpio] != nullptr) {
+      by_gpio[gpio]->Capture(now);
+    }
+  }
+
+  void Capture(uint64_t now) {
+    if (now - last_us < CLOCK_IN_HOLDOFF_US) {
+      return;
+    }
+    last_us = now;
+    uint8_t next = (head + 1) & (CLOCK_IN_EDGES - 1);
+    if (next == tail) {
+      dropped++;
+      return;
+    }
+    edges[head] = now;
+    head = next;
+  }
+
+ public:
+  // Init captures falling edges on gpio_ (the clock input circuit inverts,
+  // so this is the rising edge of the pulse at the jack)
+  void Init(uint8_t gpio_, uint32_t edge = GPIO_IRQ_EDGE_FALL) {
+    gpio = gpio_;
+    head = 0;
+    tail = 0;
+    last_us = 0;
+    dropped = 0;
+
+    gpio_init(gpio);
+    gpio_set_dir(gpio, GPIO_IN);
+    gpio_pull_down(gpio);
+
+    by_gpio[gpio] = this;
+    // one callback per core serves every ClockIn
+    gpio_set_irq_enabled_with_callback(gpio, edge, true, Callback);
+    irq_set_priority(IO_IRQ_BANK0, PICO_HIGHEST_IRQ_PRIORITY);
+  }
+
+  // Next pops the oldest edge, returns false if there is none
+  bool Next(uint64_t &t) {
+    if (tail == head) {
+      return false;
+    }
+    t = edges[tail];
+    tail = (tail + 1) & (CLOCK_IN_EDGES - 1);
+    return true;
+  }
+
+  // Dropped counts edges lost to a full ring
+  uint32_t Dropped() { return dropped; }
+};
+
+#endif
@@ -0,0 +1,69 @@
+// ClockOut - clock pulses at a ratio of the audio beat
+//
+// Tick() runs in the audio interrupt on every sample, after the beat
+// boundary has been handled, with the position in the beat and the beat's
+// length in samples. It sends multiply pulses for every divide beats,
+// evenly spaced: pulse k of a group is due once
+//
+//   (beats into the group * length + beat_counter) * multiply
+//       >= k * divide * length
+//
+// so each lands on the first sample at or after its exact time, and the
+// first one of every group on the beat itself. Because the pulses come from
+// the same counter as the audio, a unit clocked from this output follows
+// the beat without drift. Pulses still owed when a beat is cut short are
+// skipped, not bunched up. Restart() starts a new group at the next beat.
+// sample is the audio sample the tick plays on and now the one playing, they
+// differ while audio is rendered ahead of the output (see TriggerOut).
+
+#ifndef CLOCK_OUT_H
+#define CLOCK_OUT_H
+
+#include <stdint.h>
+
+#include "trigger_out.h"
+
+class ClockOut {
+  TriggerOut pulse;
+  uint8_t multiply;
+  uint8_t divide;
+  uint8_t beat;  // beats into the group
+  uint8_t tick;  // pulses sent in the group
+  bool restart;
+
+ public:
+  void Init(PIO pio, uint8_t gpio, uint32_t width_us, uint8_t multiply_,
+            uint8_t divide_) {
+    pulse.Init(pio, gpio, width_us);
+    multiply = multiply_ > 0 ? multiply_ : 1;
+    divide = divide_ > 0 ? divide_ : 1;
+    beat = 0;
+    tick = 0;
+    restart = true;
+  }
+
+  void __not_in_flash_func(Restart)() { restart = true; }
+
+  void __not_in_flash_func(Tick)(uint32_t beat_counter, uint32_t length,
+                                uint32_t sample, uint32_t now) {
+    if (beat_counter == 0) {
+      beat++;
+      if (restart || beat >= divide) {
+        restart = false;
+        beat = 0;
+        tick = 0;
+      }
+    }
+    if (tick < multiply &&
+        ((uint64_t)beat * length + beat_counter) * multiply >=
+            (uint64_t)tick * divide * length) {
+      tick++;
+      pulse.TriggerAt(sample, now);
+    }
+  }
+
+  // Pump fires pulses held back to now, see TriggerOut::TriggerAt
+  void __not_in_flash_func(Pump)(uint32_t now) { pulse.Pump(now); }
+};
+
+#endif
@@ -1 +1,17 @@
-#define FLASH_TARGET_OFFSET 65536
+// flash layout, offsets from the start of flash:
+//
+//   0                    firmware image (code and a linked sample bank)
+//   SAMPLE_BANK_OFFSET   sample partition, up to SETTINGS_OFFSET
+//   SETTINGS_OFFSET      settings journal, the last SETTINGS_REGION_SIZE
+//
+// A firmware image with a large linked bank may run past SAMPLE_BANK_OFFSET,
+// which only disables the sample partition. It has to end below
+// SETTINGS_OFFSET: the placement report fails the build if it does not (see
+// __settings_offset in main.cpp).
+
+// sample partition, written by samples-only UF2s (audio2h --uf2)
+#define SAMPLE_BANK_OFFSET (1024 * 1024)
+
+// settings journal, at the end of flash so it does not limit the image
+#define SETTINGS_REGION_SIZE (16 * 1024)
+#define SETTINGS_OFFSET (PICO_FLASH_SIZE_BYTES - SETTINGS_REGION_SIZE)
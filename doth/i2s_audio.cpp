@@ -5,6 +5,10 @@
 #include "hardware/clocks.h"
 #include <stdio.h>
 
+// aligned for the DMA read ring
+static uint8_t i2s_bridge[I2S_AUDIO_BRIDGE_SIZE]
+    __attribute__((aligned(I2S_AUDIO_BRIDGE_SIZE)));
+
 void I2SAudio::Init(uint32_t sample_rate_, PIO pio_instance, uint state_machine,
                     uint data_pin_, uint bck_pin_, uint lck_pin_) {
     pio = pio_instance;
@@ -14,6 +18,9 @@ void I2SAudio::Init(uint32_t sample_rate_, PIO pio_instance, uint state_machine,
     lck_pin = lck_pin_;
     sample_rate = sample_rate_;
     
+    // keep the state machine from pio_claim_unused_sm() elsewhere
+    pio_sm_claim(pio, sm);
+
     // Load PIO program
     offset = pio_add_program(pio, &i2s_audio_program);
     
@@ -25,7 +32,21 @@ void I2SAudio::Init(uint32_t sample_rate_, PIO pio_instance, uint state_machine,
                           sample_rate, system_clock_hz);
     
     initialized = true;
-    
+
+    // DMA from the bridge queue into the FIFO, paced by the state machine
+    bridge_state = I2S_BRIDGE_OFF;
+    bridge_head = 0;
+    bridge_tail = 0;
+    underruns = 0;
+    dma = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_ring(&c, false, I2S_AUDIO_BRIDGE_BITS);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+    dma_channel_configure(dma, &c, &pio->txf[sm], i2s_bridge, 0, false);
+
     // Pre-fill FIFO with silence to prevent stalling
     // This ensures smooth startup when timer begins
     for (int i = 0; i < 4; i++) {
@@ -43,9 +64,13 @@ void I2SAudio::Init(uint32_t sample_rate_, PIO pio_instance, uint state_machine,
 #endif
 }
 
-void I2SAudio::WriteSample(uint8_t sample_8bit) {
+void __not_in_flash_func(I2SAudio::WriteSample)(uint8_t sample_8bit) {
     if (!initialized) return;
-    
+    if (bridge_state == I2S_BRIDGE_HOLD) {
+        Queue(sample_8bit ^ 0x80);
+        return;
+    }
+
     // Convert 8-bit unsigned (0-255, center at 128) to 16-bit signed
     // 8-bit: 0 = most negative, 128 = silence, 255 = most positive
     // 16-bit: -32768 = most negative, 0 = silence, +32767 = most positive
@@ -59,9 +84,13 @@ void I2SAudio::WriteSample(uint8_t sample_8bit) {
     pio_sm_put(pio, sm, i2s_data);
 }
 
-void I2SAudio::WriteSilence() {
+void __not_in_flash_func(I2SAudio::WriteSilence)() {
     if (!initialized) return;
-    
+    if (bridge_state == I2S_BRIDGE_HOLD) {
+        if (CanWrite()) Queue(0);
+        return;
+    }
+
     // Silence is 0x00000000 (both channels at 0)
     pio_sm_put(pio, sm, 0x00000000);
 }
@@ -75,3 +104,56 @@ void I2SAudio::Stop() {
     if (!initialized) return;
     pio_sm_set_enabled(pio, sm, false);
 }
+
+void __not_in_flash_func(I2SAudio::Queue)(uint8_t sample_8bit) {
+    uint16_t next = (bridge_head + 1) & (I2S_AUDIO_BRIDGE_SIZE - 1);
+    if (next != bridge_tail) {
+        i2s_bridge[bridge_head] = sample_8bit;
+        bridge_head = next;
+    }
+    Pump();
+}
+
+void __not_in_flash_func(I2SAudio::Pump)() {
+    while (bridge_tail != bridge_head && !pio_sm_is_tx_fifo_full(pio, sm)) {
+        pio_sm_put(pio, sm, i2s_bridge[bridge_tail] * 0x01010101u);
+        bridge_tail = (bridge_tail + 1) & (I2S_AUDIO_BRIDGE_SIZE - 1);
+    }
+}
+
+void I2SAudio::Hold(uint16_t lead) {
+    if (!initialized || bridge_state != I2S_BRIDGE_OFF) return;
+    bridge_head = 0;
+    bridge_tail = 0;
+    bridge_lead = lead < I2S_AUDIO_BRIDGE_SIZE ? lead
+                                               : I2S_AUDIO_BRIDGE_SIZE - 1;
+    bridge_state = I2S_BRIDGE_HOLD;
+}
+
+bool I2SAudio::Held() {
+    return bridge_state == I2S_BRIDGE_HOLD && Queued() >= bridge_lead;
+}
+
+void I2SAudio::Bridge() {
+    if (bridge_state != I2S_BRIDGE_HOLD) return;
+    uint16_t n = Queued();
+    bridge_state = I2S_BRIDGE_PLAY;
+    // stall flags from before are not ours
+    pio->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+    dma_channel_set_read_addr(dma, &i2s_bridge[bridge_tail], false);
+    dma_channel_set_trans_count(dma, n, true);
+}
+
+bool __not_in_flash_func(I2SAudio::Bridging)() {
+    if (bridge_state != I2S_BRIDGE_PLAY) return false;
+    if (dma_channel_is_busy(dma)) return true;
+    // the state machine stalls on an empty FIFO, it did if the queue ran
+    // out before the interrupt got back to writing
+    if (pio->fdebug & (1u << (PIO_FDEBUG_TXSTALL_LSB + sm))) {
+        underruns++;
+    }
+    bridge_head = 0;
+    bridge_tail = 0;
+    bridge_state = I2S_BRIDGE_OFF;
+    return false;
+}
@@ -1,13 +1,35 @@
 // I2S Audio Output Module
 // Provides interrupt-driven I2S audio output via PIO
 // Converts 8-bit unsigned audio to 16-bit signed stereo I2S
+//
+// Flash writes stall the CPU for up to 400 ms. To keep the output going,
+// Hold() makes WriteSample() queue samples in RAM instead of writing them
+// straight to the FIFO. The caller then renders a pre-roll, running the
+// engine in a burst until Held(), which is when the queue holds the lead
+// given to Hold(): enough audio to outlast the flash write that follows.
+// From then on CanWrite() only takes a sample when one has gone out to the
+// FIFO, so the queue keeps its lead and the output runs at its usual rate.
+// Bridge() hands the queue to DMA with interrupts off, and the flash write
+// goes ahead while DMA plays it.
+// While Bridging(), the interrupt renders nothing, so the engine picks up
+// where the output is when the queue runs out.
 
 #ifndef I2S_AUDIO_H
 #define I2S_AUDIO_H
 
+#include "hardware/dma.h"
 #include "hardware/pio.h"
 #include "pico/types.h"
 
+#define I2S_AUDIO_BRIDGE_BITS 15
+#define I2S_AUDIO_BRIDGE_SIZE (1 << I2S_AUDIO_BRIDGE_BITS)  // 680 ms at 48 kHz
+// leads for Hold(), at 48 kHz: a page program takes up to 3 ms, a sector
+// erase up to 400 ms (W25Q128JV datasheet maximums)
+#define I2S_AUDIO_BRIDGE_PROGRAM 4800  // 100 ms
+#define I2S_AUDIO_BRIDGE_ERASE 24000   // 500 ms
+
+enum { I2S_BRIDGE_OFF, I2S_BRIDGE_HOLD, I2S_BRIDGE_PLAY };
+
 class I2SAudio {
 private:
     PIO pio;
@@ -18,10 +40,23 @@ private:
     uint lck_pin;
     uint32_t sample_rate;
     bool initialized;
-    
+    int dma;
+    volatile uint8_t bridge_state;
+    volatile uint16_t bridge_head;
+    volatile uint16_t bridge_tail;
+    uint16_t bridge_lead;
+    uint32_t underruns;
+
+    // samples are queued signed; an 8-bit DMA write to the FIFO repeats the
+    // byte over all four lanes, the interrupt writes the same word
+    void Queue(uint8_t sample_8bit);
+    void Pump();
+
 public:
     // Constructor
-    I2SAudio() : pio(nullptr), sm(0), offset(0), initialized(false) {}
+    I2SAudio()
+        : pio(nullptr), sm(0), offset(0), initialized(false),
+          bridge_state(I2S_BRIDGE_OFF) {}
     
     // Initialize PIO state machine
     // sample_rate: Audio sample rate in Hz (e.g., 31000)
@@ -41,8 +76,40 @@ public:
     // Returns true if we can write without blocking
     inline bool CanWrite() {
         if (!initialized) return false;
+        if (bridge_state == I2S_BRIDGE_HOLD) {
+            // top the queue up to the lead, never past it
+            Pump();
+            return Queued() < bridge_lead;
+        }
         return !pio_sm_is_tx_fifo_full(pio, sm);
     }
+
+    // Hold starts queueing up to lead samples ahead of the output, less
+    // than I2S_AUDIO_BRIDGE_SIZE
+    void Hold(uint16_t lead);
+
+    // Held is true once the lead is queued
+    bool Held();
+
+    // Holding is true from Hold() until Bridge()
+    inline bool Holding() { return bridge_state == I2S_BRIDGE_HOLD; }
+
+    // Queued counts the samples waiting in the queue
+    inline uint16_t Queued() {
+        return (bridge_head - bridge_tail) & (I2S_AUDIO_BRIDGE_SIZE - 1);
+    }
+
+    // Bridge plays the queue by DMA and stops queueing. Call it with
+    // interrupts disabled right before a flash write; without one it drains
+    // a Hold() that is no longer needed.
+    void Bridge();
+
+    // Bridging is true while DMA still plays the queue, the interrupt
+    // should not render then
+    bool Bridging();
+
+    // Underruns counts bridges that ran dry before interrupts came back
+    uint32_t Underruns() { return underruns; }
     
     // Start audio output (enable state machine)
     void Start();
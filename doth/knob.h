@@ -1,10 +1,13 @@
+#include "knob_filter.h"
+
 class Knob {
   uint8_t input;
-  uint16_t val[2];  // 0 = current value, 1 = last value
+  uint16_t val[2];  // 0 = latest oversampled read, 1 = filtered value
   uint16_t val_max;
   uint16_t alpha;
   uint16_t startup;
   bool changed;
+  KnobFilter filter;
 
  public:
   void Init(uint8_t input_, uint16_t alpha_) {
@@ -14,6 +17,7 @@ class Knob {
     // val_max = 4095 - ((4095 * alpha) >> 10);
     val_max = 4095;
     startup = 800;
+    filter.Init(alpha);
   }
 
   void Reset() { startup = 800; }
@@ -22,13 +26,15 @@ class Knob {
   uint16_t ValueMax() { return val_max; }
   void Read() {
     adc_select_input(input);
-    uint16_t adc = 4095 - adc_read();
-    val[0] = adc;
-    // val[0] = ((alpha * adc) + (1024 - alpha) * val[0]) >> 10;
-    changed = abs(val[0] - val[1]) > 100;
-    if (changed) {
-      val[1] = val[0];
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < KNOB_OVERSAMPLE; i++) {
+      sum += adc_read();
     }
+    // inverted, in 1/16 LSB
+    sum = KNOB_OVERSAMPLE * 4095 - sum;
+    val[0] = sum / KNOB_OVERSAMPLE;
+    changed = filter.Update(sum);
+    val[1] = filter.Value();
   }
   bool Changed() {
     // prevent reading on startup
@@ -0,0 +1,72 @@
+// KnobFilter - adaptive smoothing with hysteresis for oversampled knob reads
+//
+// Input is the sum of KNOB_OVERSAMPLE 12-bit reads, i.e. the knob in 1/16
+// LSB. A one-pole low pass follows it with a coefficient that grows with the
+// distance to the input beyond KNOB_FILTER_NOISE: while the knob is still,
+// the filter is heavy (alpha) and what noise is left after oversampling
+// averages out, and once it moves the filter opens up and tracks within a
+// few updates. Value() only moves when the filtered value leaves a window of
+// KNOB_FILTER_HYSTERESIS around it, so a knob at rest does not report
+// changes.
+
+#ifndef KNOB_FILTER_H
+#define KNOB_FILTER_H
+
+#include <stdint.h>
+
+#define KNOB_OVERSAMPLE 16
+#define KNOB_FILTER_NOISE 256       // 1 LSB, in 1/256 LSB
+#define KNOB_FILTER_SENSITIVITY 16  // alpha added per 1/16 LSB above noise
+#define KNOB_FILTER_HYSTERESIS 384  // 1.5 LSB, in 1/256 LSB
+
+class KnobFilter {
+  int32_t y;       // filtered value in 1/256 LSB
+  uint16_t out;    // 0-4095
+  uint16_t alpha;  // smoothing when still (0-1024)
+  bool primed;
+
+ public:
+  void Init(uint16_t alpha_) {
+    alpha = alpha_;
+    y = 0;
+    out = 0;
+    primed = false;
+  }
+
+  // Update takes a value in 1/16 LSB (0-65520) and returns true if Value()
+  // changed
+  bool Update(uint32_t x16) {
+    int32_t x = (int32_t)x16 << 4;
+    if (!primed) {
+      y = x;
+      primed = true;
+    } else {
+      int32_t d = x - y;
+      uint32_t dist = d < 0 ? -d : d;
+      uint32_t a = alpha;
+      if (dist > KNOB_FILTER_NOISE) {
+        a += ((dist - KNOB_FILTER_NOISE) >> 4) * KNOB_FILTER_SENSITIVITY;
+      }
+      if (a > 1024) {
+        a = 1024;
+      }
+      y += (d * (int32_t)a) >> 10;
+    }
+    uint16_t v = (y + 128) >> 8;
+    if (v == out) {
+      return false;
+    }
+    int32_t window = y - ((int32_t)out << 8);
+    // the ends are always reachable, the window would stop half an LSB short
+    if (window > KNOB_FILTER_HYSTERESIS || window < -KNOB_FILTER_HYSTERESIS ||
+        v == 0 || v == 4095) {
+      out = v;
+      return true;
+    }
+    return false;
+  }
+
+  uint16_t Value() { return out; }
+};
+
+#endif
@@ -1,6 +1,6 @@
 // Include shift register headers only when needed
 #if defined(SHIFT_REGISTER_ENABLED) && SHIFT_REGISTER_ENABLED == 1
-#include "shift_register.h"
+#include "shift_register_bcm.h"
 #include "led_mapper.h"
 #endif
 
@@ -8,19 +8,18 @@ class LEDArray {
 #if defined(SHIFT_REGISTER_ENABLED) && SHIFT_REGISTER_ENABLED == 1
   // ========================================================================
   // PATH 2: NEW - Shift Register Implementation (16 LEDs - two cascaded registers)
+  // Dimming is done by PIO/DMA (binary code modulation), see shift_register_bcm.h
   // ========================================================================
-  ShiftRegister shift_reg;
+  ShiftRegisterBCM shift_reg;
   uint8_t vals[16];      // Brightness values 0-255 for 16 LEDs
-  uint8_t dim_i;         // PWM counter for software dimming
   uint16_t do_leds;      // Update counter
 
  public:
   void Init() {
-    shift_reg.Init(SR_SER_PIN, SR_SRCLK_PIN, SR_RCLK_PIN);
+    shift_reg.Init(pio0, SR_SER_PIN, SR_SRCLK_PIN, SR_RCLK_PIN);
     for (uint8_t i = 0; i < 16; i++) {
       vals[i] = 0;
     }
-    dim_i = 0;
     do_leds = 0;
   }
 
@@ -35,35 +34,19 @@ class LEDArray {
   void LedSet(uint8_t i, uint8_t v) {
     if (i < 16) {
       uint8_t bit = LEDMapper::LogicalToBit(i);
-      shift_reg.SetBit(bit, v > 0);
+      shift_reg.Set(bit, v > 0 ? 255 : 0);
     }
   }
 
-  void LedUpdate(uint8_t i) {
-    // Software PWM: called frequently for individual LED
-    if (i < 16) {
-      uint8_t bit = LEDMapper::LogicalToBit(i);
-      shift_reg.SetBit(bit, dim_i < vals[i]);
-    }
-  }
+  // dimming runs in hardware, nothing to do per LED
+  void LedUpdate(uint8_t i) {}
 
   void Update() {
-    dim_i++;
-    
-    // Debug: Print state periodically
-    static uint32_t debug_counter = 0;
-    if (++debug_counter >= 20000) {  // Every 20000 calls (~1 second at 20kHz)
-      debug_counter = 0;
-      printf("[LED Update] dim_i=%d, vals[0]=%d, vals[1]=%d, vals[7]=%d\n", 
-             dim_i, vals[0], vals[1], vals[7]);
-    }
-    
-    // Apply software PWM to all LEDs
+    // Only rebuilds the PIO frame when a brightness changed
     for (uint8_t i = 0; i < 16; i++) {
       uint8_t bit = LEDMapper::LogicalToBit(i);
-      shift_reg.SetBit(bit, dim_i < vals[i]);
+      shift_reg.Set(bit, vals[i]);
     }
-    // Single hardware update for all LEDs
     shift_reg.Update();
   }
 
@@ -135,7 +118,7 @@ class LEDArray {
     shift_reg.Clear();
     if (led_index < 8) {
       uint8_t bit = LEDMapper::LogicalToBit(led_index);
-      shift_reg.SetBit(bit, true);
+      shift_reg.Set(bit, 255);
     }
     shift_reg.Update();
   }
@@ -0,0 +1,87 @@
+// MidiClockOut - 24 PPQN MIDI clock and transport from the audio engine
+//
+// Tick() runs in the audio interrupt for every sample played, after the beat
+// has been counted. A beat (eighth note) is MIDI_CLOCK_OUT_PER_BEAT clocks
+// and clock k is due once beat_counter * 12 reaches k * the beat length, so
+// clocks land on the first sample at or after their exact time and follow
+// the beats without drifting from the audio. A beat cut short by a resync
+// first sends the clocks it still owes, receivers always count whole beats.
+//
+// Start() and Stop() are called from the main loop. Stop goes out from the
+// interrupt on the next sample (Transport() runs while muted too); Start
+// goes out with a song position of 0 right before the first clock of the
+// next beat. Everything is sent through the MidiOut queue.
+
+#ifndef MIDI_CLOCK_OUT_H
+#define MIDI_CLOCK_OUT_H
+
+#include <stdint.h>
+
+#include "midi_out.h"
+
+#define MIDI_CLOCK_OUT_PER_BEAT 12
+
+class MidiClockOut {
+  volatile bool start_pending;
+  volatile bool stop_pending;
+  bool running;
+  uint8_t tick;  // clocks sent in this beat
+
+  void __not_in_flash_func(Send)(uint8_t status, uint32_t sample) {
+    MidiOut_queue(&status, 1, sample);
+  }
+
+ public:
+  // Init starts on the first beat, pikocore plays from power on
+  void Init() {
+    start_pending = true;
+    stop_pending = false;
+    running = false;
+    tick = 0;
+  }
+
+  void Start() { start_pending = true; }
+  void Stop() { stop_pending = true; }
+
+  // Transport runs in the audio interrupt before the mute check
+  void __not_in_flash_func(Transport)(uint32_t sample) {
+    if (stop_pending) {
+      stop_pending = false;
+      if (running) {
+        Send(0xFC, sample);
+        running = false;
+      }
+    }
+  }
+
+  // Tick runs in the audio interrupt, beat_counter is 0 on the first sample
+  // of a beat and length is the length of the beat in samples
+  void __not_in_flash_func(Tick)(uint32_t beat_counter, uint32_t length,
+                                uint32_t sample) {
+    if (beat_counter == 0) {
+      if (running) {
+        for (; tick < MIDI_CLOCK_OUT_PER_BEAT; tick++) {
+          Send(0xF8, sample);
+        }
+      }
+      if (start_pending) {
+        start_pending = false;
+        const uint8_t position[3] = {0xF2, 0, 0};
+        MidiOut_queue(position, 3, sample);
+        Send(0xFA, sample);
+        running = true;
+      }
+      tick = 0;
+    }
+    if (!running) {
+      return;
+    }
+    while (tick < MIDI_CLOCK_OUT_PER_BEAT &&
+           beat_counter * MIDI_CLOCK_OUT_PER_BEAT >= tick * length) {
+      Send(0xF8, sample);
+      tick++;
+    }
+  }
+};
+
+#endif
@@ -5,12 +5,96 @@ extern "C" {
 #ifndef MIDIOUT_LIB
 #define MIDIOUT_LIB 1
 
+// Messages are not written to USB where they are made (in the audio
+// interrupt, while tud_task may be running) but queued with the audio
+// sample they are due at. MidiOut_task, run next to tud_task, sends every
+// due message in one tud_midi_n_stream_write, so one USB frame carries them
+// in a single transfer, and hands each one to an optional second output.
+// The queue has one producer and one consumer and needs no locks.
+#define MIDIOUT_QUEUE_SIZE 64  // power of two
+#define MIDIOUT_BATCH 16       // 4-byte packets in a 64-byte USB transfer
+
+typedef struct MidiOutMessage {
+  uint32_t sample;  // audio sample the message is due at
+  uint8_t len;
+  uint8_t msg[3];
+} MidiOutMessage;
+
+typedef struct MidiOutQueue {
+  MidiOutMessage messages[MIDIOUT_QUEUE_SIZE];
+  volatile uint16_t head;  // written by the producer
+  volatile uint16_t tail;  // written by MidiOut_task
+  uint32_t dropped_full;   // queue was full
+  uint32_t dropped_usb;    // usb midi was not mounted
+  uint32_t transfers;
+} MidiOutQueue;
+
+static MidiOutQueue midiout_queue;
+
 typedef struct MidiOut {
   uint8_t channel : 7;
   uint8_t monophonic : 1;
   int8_t last;
 } MidiOut;
 
+// MidiOut_queue adds a message of up to 3 bytes due at sample, returns false
+// if the queue is full
+bool __not_in_flash_func(MidiOut_queue)(const uint8_t *msg, uint8_t len,
+                                        uint32_t sample) {
+  MidiOutQueue *q = &midiout_queue;
+  uint16_t next = (q->head + 1) & (MIDIOUT_QUEUE_SIZE - 1);
+  if (next == q->tail) {
+    q->dropped_full++;
+    return false;
+  }
+  MidiOutMessage *m = &q->messages[q->head];
+  m->sample = sample;
+  m->len = len;
+  for (uint8_t i = 0; i < len; i++) {
+    m->msg[i] = msg[i];
+  }
+  __dmb();  // the message is complete before the consumer sees it
+  q->head = next;
+  return true;
+}
+
+// MidiOut_task sends the messages due by sample now, call it after
+// tud_task. copy (or NULL) gets every message as it leaves the queue.
+void MidiOut_task(uint32_t now, void (*copy)(const uint8_t *, uint8_t)) {
+  MidiOutQueue *q = &midiout_queue;
+  uint8_t buf[MIDIOUT_BATCH * 3];
+  uint8_t len = 0;
+  uint16_t n = 0;
+  uint16_t i = q->tail;
+  while (i != q->head && n < MIDIOUT_BATCH &&
+         (int32_t)(now - q->messages[i].sample) >= 0) {
+    for (uint8_t j = 0; j < q->messages[i].len; j++) {
+      buf[len++] = q->messages[i].msg[j];
+    }
+    n++;
+    i = (i + 1) & (MIDIOUT_QUEUE_SIZE - 1);
+  }
+  if (n == 0) {
+    return;
+  }
+  uint32_t written = len;
+  if (tud_midi_mounted()) {
+    // what did not fit in the TinyUSB FIFO waits for the next frame
+    written = tud_midi_n_stream_write(0, 0, buf, len);
+    q->transfers++;
+  } else {
+    q->dropped_usb += n;
+  }
+  while (q->tail != i && written >= q->messages[q->tail].len) {
+    MidiOutMessage *m = &q->messages[q->tail];
+    written -= m->len;
+    if (copy != NULL) {
+      copy(m->msg, m->len);
+    }
+    q->tail = (q->tail + 1) & (MIDIOUT_QUEUE_SIZE - 1);
+  }
+}
+
 MidiOut *MidiOut_malloc(uint8_t channel, bool monophonic) {
   MidiOut *self = (MidiOut *)malloc(sizeof(MidiOut));
   self->channel = channel;
@@ -21,27 +105,28 @@ MidiOut *MidiOut_malloc(uint8_t channel, bool monophonic) {
 
 void MidiOut_free(MidiOut *self) { free(self); }
 
-void MidiOut_on(MidiOut *self, uint8_t note, uint8_t velocity) {
+void __not_in_flash_func(MidiOut_on)(MidiOut *self, uint8_t note,
+                                     uint8_t velocity, uint32_t sample) {
   uint8_t msg[3];
   if (self->monophonic && self->last != -1) {
     msg[0] = 0x80 | (self->channel & 0x0F);
     msg[1] = self->last;
     msg[2] = 0;
-    tud_midi_n_stream_write(0, 0, msg, 3);
+    MidiOut_queue(msg, 3, sample);
   }
   msg[0] = 0x90 | (self->channel & 0x0F);
   msg[1] = note;
   msg[2] = velocity;
-  tud_midi_n_stream_write(0, 0, msg, 3);
+  MidiOut_queue(msg, 3, sample);
   self->last = note;
 }
 
-void MidiOut_off(MidiOut *self, uint8_t note) {
+void MidiOut_off(MidiOut *self, uint8_t note, uint32_t sample) {
   uint8_t msg[3];
   msg[0] = 0x80 | (self->channel & 0x0F);
   msg[1] = note;
   msg[2] = 0;
-  tud_midi_n_stream_write(0, 0, msg, 3);
+  MidiOut_queue(msg, 3, sample);
   if (self->last == note) {
     self->last = -1;
   }
@@ -50,4 +135,4 @@ void MidiOut_off(MidiOut *self, uint8_t note) {
 #endif
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
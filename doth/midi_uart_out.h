@@ -0,0 +1,61 @@
+// MidiUartOut - MIDI out on a spare GPIO through a PIO UART
+//
+// Write() copies bytes into a ring and Pump() moves them into the state
+// machine's FIFO as it drains, 320 us per byte at 31250 baud. Both run in
+// the main loop; bytes that do not fit in the ring are dropped and counted.
+
+#ifndef MIDI_UART_OUT_H
+#define MIDI_UART_OUT_H
+
+#include <stdint.h>
+
+#include "hardware/clocks.h"
+#include "hardware/pio.h"
+#include "midi_uart_tx.pio.h"
+
+#define MIDI_UART_OUT_BAUD 31250
+#define MIDI_UART_OUT_RING 64  // power of two
+
+class MidiUartOut {
+  PIO pio;
+  uint sm;
+  uint8_t ring[MIDI_UART_OUT_RING];
+  uint8_t head;
+  uint8_t tail;
+  uint32_t dropped;
+
+ public:
+  void Init(PIO pio_, uint8_t pin) {
+    pio = pio_;
+    sm = pio_claim_unused_sm(pio, true);
+    head = 0;
+    tail = 0;
+    dropped = 0;
+    uint offset = pio_add_program(pio, &midi_uart_tx_program);
+    midi_uart_tx_program_init(pio, sm, offset, pin, MIDI_UART_OUT_BAUD);
+  }
+
+  void Write(const uint8_t *msg, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+      uint8_t next = (head + 1) & (MIDI_UART_OUT_RING - 1);
+      if (next == tail) {
+        dropped += len - i;
+        break;
+      }
+      ring[head] = msg[i];
+      head = next;
+    }
+    Pump();
+  }
+
+  void Pump() {
+    while (tail != head && !pio_sm_is_tx_fifo_full(pio, sm)) {
+      pio_sm_put(pio, sm, ring[tail]);
+      tail = (tail + 1) & (MIDI_UART_OUT_RING - 1);
+    }
+  }
+
+  uint32_t Dropped() { return dropped; }
+};
+
+#endif
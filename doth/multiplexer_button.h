@@ -0,0 +1,180 @@
+// MultiplexerButton - Read 16 buttons via 74HC4067 multiplexer
+//
+// Hardware connections:
+// - GPIO21: COM pin - digital input from multiplexer (pulled up, low = pressed)
+// - GPIO14-17: S0-S3 select pins (shared with knob multiplexer)
+//
+// A PIO program (multiplexer_button.pio) cycles the select lines, samples
+// COM once per channel and pushes a scan only when a button changed, so the
+// CPU is interrupted on changes only. The interrupt timestamps each change
+// with the time its channel was sampled and debounces it: a change is
+// reported at its first edge and the button is then ignored for
+// DEBOUNCE_US. Events queue up for the main loop, which can quantize a
+// press by its time instead of by when the loop got to it.
+//
+// The PIO owns S0-S3 once started, so the knob scanner has to follow it:
+//
+//   MultiplexerKnob knobs;
+//   MultiplexerButton buttons;
+//   knobs.Init(200);
+//   buttons.Init(pio0);
+//   knobs.Follow(buttons.Pio(), buttons.Sm());
+//
+//   // In main loop:
+//   ButtonEvent e;
+//   while (buttons.Next(e)) {
+//     // e.button pressed (e.pressed) or released at e.time_us
+//   }
+//   bool on = buttons.On(button);  // Debounced state
+
+#ifndef MULTIPLEXER_BUTTON_H
+#define MULTIPLEXER_BUTTON_H
+
+#include "hardware/clocks.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "multiplexer_button.pio.h"
+#include "pico/stdlib.h"
+
+typedef struct ButtonEvent {
+  uint32_t time_us;  // when the scanner saw the change, time_us_32()
+  uint8_t button;
+  bool pressed;
+} ButtonEvent;
+
+class MultiplexerButton {
+ private:
+  // GPIO pins
+  static const uint8_t PIN_COM = 21;  // COM pin
+  static const uint8_t PIN_S0 = 14;   // Select bits 0-3 on GPIO14-17
+
+  // Number of channels
+  static const uint8_t NUM_CHANNELS = 16;
+
+  // Timing of multiplexer_button.pio: one channel every STEP_US, and the
+  // push comes SCAN_TAIL_US after channel 0 (the last one) was sampled
+  static const uint32_t STEP_US = 100;
+  static const uint32_t SCAN_TAIL_US = 20;
+
+  // Changes within this time of the last accepted one are bounces
+  static const uint32_t DEBOUNCE_US = 5000;
+
+  // Event queue, main loop reads it with Next()
+  static const uint8_t NUM_EVENTS = 32;
+
+  PIO pio;
+  uint sm;
+  uint irq_num;
+  volatile uint16_t raw;    // pressed buttons in the last scan
+  volatile uint16_t state;  // debounced
+  uint32_t raw_time[NUM_CHANNELS];     // when raw last changed
+  uint32_t accept_time[NUM_CHANNELS];  // when state last changed
+  ButtonEvent events[NUM_EVENTS];
+  volatile uint8_t events_head;
+  volatile uint8_t events_tail;
+
+  static inline MultiplexerButton *instance = nullptr;
+
+  void Push(uint8_t button, bool pressed, uint32_t time_us) {
+    uint8_t next = (events_head + 1) % NUM_EVENTS;
+    if (next == events_tail) {
+      return;  // main loop is not reading, drop the event
+    }
+    events[events_head].time_us = time_us;
+    events[events_head].button = button;
+    events[events_head].pressed = pressed;
+    events_head = next;
+  }
+
+  // Debounce moves buttons whose lockout has passed to their raw state
+  void Debounce(uint32_t now) {
+    uint16_t diff = raw ^ state;
+    for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+      if (!(diff & (1 << i)) || now - accept_time[i] < DEBOUNCE_US) {
+        continue;
+      }
+      state ^= (1 << i);
+      accept_time[i] = now;
+      Push(i, (state >> i) & 1, raw_time[i]);
+    }
+  }
+
+  static void IRQHandler() {
+    MultiplexerButton *b = instance;
+    while (!pio_sm_is_rx_fifo_empty(b->pio, b->sm)) {
+      uint32_t now = time_us_32();
+      uint16_t pressed = ~pio_sm_get(b->pio, b->sm) & 0xFFFF;
+      uint16_t diff = pressed ^ b->raw;
+      for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+        if (diff & (1 << i)) {
+          b->raw_time[i] = now - SCAN_TAIL_US - i * STEP_US;
+        }
+      }
+      b->raw = pressed;
+      b->Debounce(now);
+    }
+  }
+
+ public:
+  // Initialize the multiplexer and start the PIO scanner on a free state
+  // machine of pio_
+  void Init(PIO pio_) {
+    pio = pio_;
+    sm = pio_claim_unused_sm(pio, true);
+    raw = 0;
+    state = 0;
+    events_head = 0;
+    events_tail = 0;
+    uint32_t now = time_us_32();
+    for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
+      raw_time[i] = now;
+      accept_time[i] = now - DEBOUNCE_US;
+    }
+    instance = this;
+
+    irq_num = pio_get_irq_num(pio, 1);
+    irq_add_shared_handler(irq_num, IRQHandler,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    pio_set_irqn_source_enabled(
+        pio, 1, pio_get_rx_fifo_not_empty_interrupt_source(sm), true);
+    irq_set_enabled(irq_num, true);
+
+    uint offset = pio_add_program(pio, &mux_button_program);
+    mux_button_program_init(pio, sm, offset, PIN_S0, PIN_COM);
+  }
+
+  // Next pops the oldest button event, returns false if there is none
+  bool Next(ButtonEvent &e) {
+    if (raw != state) {
+      // a change that came during a lockout is only reported once the
+      // lockout has passed, and the PIO will not push again for it
+      irq_set_enabled(irq_num, false);
+      Debounce(time_us_32());
+      irq_set_enabled(irq_num, true);
+    }
+    if (events_tail == events_head) {
+      return false;
+    }
+    e = events[events_tail];
+    events_tail = (events_tail + 1) % NUM_EVENTS;
+    return true;
+  }
+
+  // Debounced state of a button
+  bool On(uint8_t button) {
+    if (button >= NUM_CHANNELS) return false;
+    return (state >> button) & 1;
+  }
+
+  // Debounced state of all buttons, button c in bit c
+  uint16_t State() { return state; }
+
+  // PIO and state machine of the scanner, for MultiplexerKnob::Follow()
+  PIO Pio() { return pio; }
+  uint Sm() { return sm; }
+
+  // Get number of channels
+  uint8_t NumChannels() { return NUM_CHANNELS; }
+};
+
+#endif  // MULTIPLEXER_BUTTON_H
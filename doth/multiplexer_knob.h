@@ -1,15 +1,25 @@
 // MultiplexerKnob - Read 16 analog knobs via 74HC4067 multiplexer
-// 
+//
 // Hardware connections:
 // - GPIO26 (ADC0): COM pin - analog input from multiplexer
 // - GPIO14-17: S0-S3 select pins (shared with button multiplexer)
-// 
+//
+// Scanning runs in the background: the ADC free-runs on GPIO26 and DMA
+// copies every conversion into a ring buffer, while a repeating timer steps
+// the select lines every STEP_US. On each step the samples taken since the
+// last one (minus the ones taken while the multiplexer settled) are summed,
+// 16x oversampling, and fed to the KnobFilter of the channel that was
+// selected. Nothing here waits on the ADC, so Read()/ReadAll() only pick up
+// what the filters already hold. When the
+// button scanner drives the select lines instead, Follow() steps on its PIO
+// interrupt (see multiplexer_button.h).
+//
 // Usage:
 //   MultiplexerKnob knobs;
-//   knobs.Init(200);  // alpha smoothing factor
-//   
+//   knobs.Init(200);  // alpha smoothing factor, starts scanning
+//
 //   // In main loop:
-//   knobs.ReadAll();  // Read all 16 knobs
+//   knobs.ReadAll();  // Update all 16 knobs from the latest scan
 //   uint16_t value = knobs.Value(channel);  // Get value 0-4095
 //   bool changed = knobs.Changed(channel);  // Check if changed
 
@@ -17,7 +27,11 @@
 #define MULTIPLEXER_KNOB_H
 
 #include "hardware/adc.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "knob_filter.h"
 #include "pico/stdlib.h"
 
 class MultiplexerKnob {
@@ -32,8 +46,25 @@ class MultiplexerKnob {
   // Number of channels
   static const uint8_t NUM_CHANNELS = 16;
 
-  // Settling time after channel selection (microseconds)
-  static const uint8_t SETTLING_TIME_US = 10;
+  // ADC conversion rate when free-running (48 MHz ADC clock)
+  static const uint32_t ADC_RATE = 200000;
+
+  // Time each channel stays selected: 20 conversions at ADC_RATE, so a
+  // full scan of 16 knobs takes 1.6 ms
+  static const uint32_t STEP_US = 100;
+
+  // Conversions dropped after selecting a channel (20 us, the 74HC4067 has
+  // ~200ns propagation delay but the ADC input needs time to recharge),
+  // which leaves KNOB_OVERSAMPLE per step
+  static const uint8_t SETTLE_SAMPLES = 4;
+
+  // DMA ring of raw conversions, must hold more than one step
+  static const uint8_t RING_BITS = 8;  // 2^8 bytes = 128 samples
+  static const uint32_t RING_SIZE = (1u << RING_BITS) / sizeof(uint16_t);
+
+  // A step arriving later than this (320 us, 3 steps) finds the ring
+  // overwritten, or about to be while it sums, and is skipped
+  static const uint32_t STEP_MAX_SAMPLES = RING_SIZE / 2;
 
   // State for each channel
   struct KnobState {
@@ -41,34 +72,97 @@ class MultiplexerKnob {
     uint16_t val_last;      // Last reported value
     uint16_t startup;       // Startup delay counter
     bool changed;           // Change flag
+    KnobFilter filter;      // Updated by the scanner every 1.6 ms
   };
 
   KnobState channels[NUM_CHANNELS];
-  uint16_t alpha;          // Smoothing factor (0-1024)
+  uint16_t alpha;          // Smoothing factor when still (0-1024)
   uint16_t val_max;        // Maximum value (typically 4095)
 
+  // written by DMA, aligned for the DMA address wrap
+  uint16_t ring[RING_SIZE] __attribute__((aligned(1 << RING_BITS)));
+  int dma_chan;
+  uint32_t ring_tail;      // first sample not yet used
+  uint32_t ring_count;     // DMA transfer count when ring_tail was taken
+  volatile uint8_t scan_channel;  // channel currently selected
+  struct repeating_timer scan_timer;
+  bool following;          // S0-S3 are driven by the button scanner
+  PIO follow_pio;
+  uint follow_sm;
+
+  static inline MultiplexerKnob *follow_instance = nullptr;
+
   // Select a channel on the multiplexer
   void SelectChannel(uint8_t channel) {
     if (channel >= NUM_CHANNELS) return;
-    
-    // Set S0-S3 pins to select the channel
-    gpio_put(PIN_S0, (channel >> 0) & 0x01);
-    gpio_put(PIN_S1, (channel >> 1) & 0x01);
-    gpio_put(PIN_S2, (channel >> 2) & 0x01);
-    gpio_put(PIN_S3, (channel >> 3) & 0x01);
-    
-    // Wait for signal to settle (74HC4067 propagation delay ~200ns)
-    sleep_us(SETTLING_TIME_US);
+
+    // Set S0-S3 pins to select the channel in one write
+    gpio_put_masked((0x0F << PIN_S0), (uint32_t)channel << PIN_S0);
   }
 
-  // Read ADC value from currently selected channel
-  uint16_t ReadADC() {
-    adc_select_input(0);  // Select ADC0 (GPIO26)
-    return 4095 - adc_read();  // Inverted like original Knob class
+  // Index in the ring the DMA writes next
+  uint32_t RingHead() {
+    return (dma_channel_hw_addr(dma_chan)->write_addr - (uintptr_t)ring) /
+           sizeof(uint16_t);
+  }
+
+  void StartDMA() {
+    // the largest count lasts ~6 hours at ADC_RATE, Step() restarts it
+    dma_channel_set_trans_count(dma_chan, 0xFFFFFFFF, true);
+    ring_count = 0xFFFFFFFF;
+  }
+
+  // Step runs from the scan timer (or the button scanner's interrupt): it
+  // stores the average for the channel that was selected and moves on
+  void Step() {
+    // the position in the ring wraps every RING_SIZE samples, the transfer
+    // count does not, so it tells a late step from a timely one
+    uint32_t transfer_count = dma_channel_hw_addr(dma_chan)->transfer_count;
+    uint32_t head = RingHead();
+    uint32_t elapsed = ring_count - transfer_count;
+    uint32_t n = (head - ring_tail) & (RING_SIZE - 1);
+    uint32_t sum = 0;
+    uint32_t count = 0;
+    for (uint32_t i = SETTLE_SAMPLES;
+         elapsed <= STEP_MAX_SAMPLES && i < n && count < KNOB_OVERSAMPLE;
+         i++) {
+      sum += ring[(ring_tail + i) & (RING_SIZE - 1)] & 0x0FFF;
+      count++;
+    }
+    ring_tail = head;
+    ring_count = transfer_count;
+    if (count > 0) {
+      // Inverted like Knob, in 1/16 LSB
+      sum = sum * KNOB_OVERSAMPLE / count;
+      channels[scan_channel].filter.Update(KNOB_OVERSAMPLE * 4095 - sum);
+    }
+    if (!dma_channel_is_busy(dma_chan)) {
+      StartDMA();
+    }
+    if (following) {
+      // the PIO has just selected the next channel
+      scan_channel = (gpio_get_all() >> PIN_S0) & 0x0F;
+    } else {
+      scan_channel = (scan_channel + 1) % NUM_CHANNELS;
+      SelectChannel(scan_channel);
+    }
+  }
+
+  static bool ScanTimerCallback(struct repeating_timer *t) {
+    ((MultiplexerKnob *)t->user_data)->Step();
+    return true;
+  }
+
+  static void FollowIRQHandler() {
+    MultiplexerKnob *k = follow_instance;
+    if (pio_interrupt_get(k->follow_pio, k->follow_sm)) {
+      pio_interrupt_clear(k->follow_pio, k->follow_sm);
+      k->Step();
+    }
   }
 
  public:
-  // Initialize the multiplexer and ADC
+  // Initialize the multiplexer and ADC and start scanning
   void Init(uint16_t alpha_ = 200) {
     alpha = alpha_;
     val_max = 4095;
@@ -83,39 +177,72 @@ class MultiplexerKnob {
     gpio_init(PIN_S3);
     gpio_set_dir(PIN_S3, GPIO_OUT);
 
-    // Initialize ADC on COM pin
-    adc_init();
-    adc_gpio_init(PIN_COM);
-
     // Initialize all channel states
     for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
       channels[i].val_current = 0;
       channels[i].val_last = 0;
       channels[i].startup = 800;  // Startup delay like original Knob
       channels[i].changed = false;
+      channels[i].filter.Init(alpha);
     }
+
+    // Initialize ADC on COM pin, free-running into the FIFO with DREQ
+    adc_init();
+    adc_gpio_init(PIN_COM);
+    adc_select_input(0);  // Select ADC0 (GPIO26)
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv(48000000 / ADC_RATE - 1);
+
+    dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config cfg = dma_channel_get_default_config(dma_chan);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+    channel_config_set_read_increment(&cfg, false);
+    channel_config_set_write_increment(&cfg, true);
+    channel_config_set_ring(&cfg, true, RING_BITS);
+    channel_config_set_dreq(&cfg, DREQ_ADC);
+    dma_channel_configure(dma_chan, &cfg, ring, &adc_hw->fifo, 0xFFFFFFFF,
+                          false);
+
+    scan_channel = 0;
+    ring_tail = 0;
+    ring_count = 0xFFFFFFFF;
+    following = false;
+    SelectChannel(scan_channel);
+    dma_channel_start(dma_chan);
+    adc_run(true);
+    add_repeating_timer_us(-(int64_t)STEP_US, ScanTimerCallback, this,
+                           &scan_timer);
+  }
+
+  // Follow stops the scan timer and steps whenever the button scanner's PIO
+  // program (state machine sm_ of pio_) raises its channel interrupt
+  void Follow(PIO pio_, uint sm_) {
+    cancel_repeating_timer(&scan_timer);
+    follow_pio = pio_;
+    follow_sm = sm_;
+    follow_instance = this;
+    following = true;
+    uint irq_num = pio_get_irq_num(follow_pio, 0);
+    irq_add_shared_handler(irq_num, FollowIRQHandler,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    pio_set_irqn_source_enabled(
+        follow_pio, 0, (pio_interrupt_source_t)(pis_interrupt0 + follow_sm),
+        true);
+    irq_set_enabled(irq_num, true);
   }
 
-  // Read a specific channel
+  // Update a specific channel from the latest scan
   void Read(uint8_t channel) {
     if (channel >= NUM_CHANNELS) return;
 
-    SelectChannel(channel);
-    uint16_t adc = ReadADC();
-
-    // Store raw value (simplified - no smoothing for now)
-    channels[channel].val_current = adc;
-
-    // Detect significant change (threshold = 100, same as original Knob)
-    channels[channel].changed = 
-        abs(channels[channel].val_current - channels[channel].val_last) > 100;
-    
-    if (channels[channel].changed) {
-      channels[channel].val_last = channels[channel].val_current;
-    }
+    // the filter's hysteresis already keeps a knob at rest from changing
+    channels[channel].val_current = channels[channel].filter.Value();
+    channels[channel].changed =
+        channels[channel].val_current != channels[channel].val_last;
+    channels[channel].val_last = channels[channel].val_current;
   }
 
-  // Read all 16 channels sequentially
+  // Update all 16 channels
   void ReadAll() {
     for (uint8_t i = 0; i < NUM_CHANNELS; i++) {
       Read(i);
@@ -157,6 +284,9 @@ class MultiplexerKnob {
     }
   }
 
+  // Channel the scanner has selected right now, S0-S3 follow it
+  uint8_t ScanChannel() { return scan_channel; }
+
   // Get number of channels
   uint8_t NumChannels() { return NUM_CHANNELS; }
 };
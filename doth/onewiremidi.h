@@ -24,8 +24,21 @@
 
 #include <stdint.h>
 
+#include "hardware/irq.h"
 #include "onewiremidi.pio.h"
 
+// Bytes are taken from the PIO by interrupt and timestamped there, so the
+// timing clock keeps the time it was received at however late
+// Onewiremidi_receive() gets to it. The PIO RX FIFO is joined to 8 words
+// (2.5 ms of bytes at 31250 baud) to cover interrupt latency, and the ring
+// holds 82 ms for the main loop. Bytes lost at either stage are counted in
+// overruns and dropped.
+//
+// The parser follows MIDI 1.0: running status, realtime bytes anywhere
+// (also between the data bytes of a message), system common messages
+// cancel running status and SysEx is skipped up to the next status byte.
+#define ONEWIREMIDI_RX_SIZE 256  // power of two
+
 enum {
   MIDI_NOTE_OFF = 0x80,
   MIDI_NOTE_ON = 0x90,
@@ -35,6 +48,9 @@ enum {
   MIDI_CHANNEL_PRESSURE = 0xd0,
   MIDI_PITCH_BEND = 0xe0,
   MIDI_SYSEX = 0xf0,
+  MIDI_TIME_CODE = 0xf1,
+  MIDI_SONG_POSITION = 0xf2,
+  MIDI_SONG_SELECT = 0xf3,
   MIDI_SYSEX_END = 0xf7,
   MIDI_TIMING_CLOCK = 0xf8,
   MIDI_ACTIVE_SENSE = 0xfe,
@@ -46,39 +62,81 @@ enum {
 typedef void (*callback_int_int)(uint8_t, uint8_t);
 typedef void (*callback_int)(uint8_t);
 typedef void (*callback_void)();
+typedef void (*callback_time)(uint64_t);
+typedef void (*callback_bend)(int16_t);
 
 typedef struct Onewiremidi {
   PIO pio;
   unsigned char sm;
-  uint8_t status;
-  uint8_t previous;
-  uint32_t last_time;
+  uint8_t status;  // running status, 0 if there is none
+  uint8_t data[2];
+  uint8_t count;   // data bytes received for status
+  bool sysex;
+  uint64_t time;   // receive time of the last complete message
   callback_int_int midi_note_on;
   callback_int midi_note_off;
   callback_void midi_start;
   callback_void midi_continue;
   callback_void midi_stop;
-  callback_void midi_timing;
+  callback_time midi_timing;
+  callback_int_int midi_control_change;
+  callback_bend midi_pitch_bend;
+  uint8_t rx[ONEWIREMIDI_RX_SIZE];
+  uint32_t rx_time[ONEWIREMIDI_RX_SIZE];  // low bits of time_us_64()
+  volatile uint16_t rx_head;  // written by the interrupt
+  volatile uint16_t rx_tail;
+  volatile uint32_t overruns;
 } Onewiremidi;
 
+static Onewiremidi *onewiremidi_instance = NULL;
+
+void Onewiremidi_irq_handler() {
+  Onewiremidi *self = onewiremidi_instance;
+  uint32_t t = (uint32_t)time_us_64();
+  // the state machine sets RXSTALL when a push found the FIFO full
+  uint32_t stall = 1u << (PIO_FDEBUG_RXSTALL_LSB + self->sm);
+  if (self->pio->fdebug & stall) {
+    self->pio->fdebug = stall;
+    self->overruns++;
+  }
+  while (!pio_sm_is_rx_fifo_empty(self->pio, self->sm)) {
+    uint8_t b = (uint8_t)pio_sm_get(self->pio, self->sm);
+    uint16_t next = (self->rx_head + 1) & (ONEWIREMIDI_RX_SIZE - 1);
+    if (next == self->rx_tail) {
+      self->overruns++;
+      continue;
+    }
+    self->rx[self->rx_head] = b;
+    self->rx_time[self->rx_head] = t;
+    self->rx_head = next;
+  }
+}
+
 Onewiremidi *Onewiremidi_new(PIO pio, unsigned char sm, const uint pin,
                              callback_int_int midi_note_on,
                              callback_int midi_note_off,
                              callback_void midi_start,
                              callback_void midi_continue,
                              callback_void midi_stop,
-                             callback_void midi_timing) {
+                             callback_time midi_timing) {
   Onewiremidi *self = (Onewiremidi *)malloc(sizeof(Onewiremidi));
   self->pio = pio;
   self->sm = sm;
   self->status = 0;
-  self->previous = 0;
+  self->count = 0;
+  self->sysex = false;
+  self->time = 0;
   self->midi_note_on = midi_note_on;
   self->midi_note_off = midi_note_off;
   self->midi_start = midi_start;
   self->midi_continue = midi_continue;
   self->midi_stop = midi_stop;
   self->midi_timing = midi_timing;
+  self->midi_control_change = NULL;
+  self->midi_pitch_bend = NULL;
+  self->rx_head = 0;
+  self->rx_tail = 0;
+  self->overruns = 0;
 
   uint offset = pio_add_program(pio, &midi_rx_program);
   pio_sm_config c = midi_rx_program_get_default_config(offset);
@@ -86,13 +144,34 @@ Onewiremidi *Onewiremidi_new(PIO pio, unsigned char sm, const uint pin,
   pio_sm_set_consecutive_pindirs(pio, sm, pin, 1, true);
   sm_config_set_set_pins(&c, pin, 1);
   sm_config_set_in_shift(&c, 0, 0, 0);  // Corrected the shift setup
+  sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
   pio_sm_init(pio, sm, offset, &c);
   pio_sm_set_clkdiv(pio, sm,
                     (float)clock_get_hz(clk_sys) / 1000000.0f);  // 1 us/cycle
   pio_sm_set_enabled(pio, sm, true);
+
+  onewiremidi_instance = self;
+  uint irq_num = pio_get_irq_num(pio, 1);
+  irq_add_shared_handler(irq_num, Onewiremidi_irq_handler,
+                         PICO_SHARED_IRQ_HANDLER_HIGHEST_ORDER_PRIORITY);
+  pio_set_irqn_source_enabled(
+      pio, 1, (pio_interrupt_source_t)(pis_sm0_rx_fifo_not_empty + sm), true);
+  irq_set_enabled(irq_num, true);
   return self;
 }
 
+// Onewiremidi_set_control_change sets the callback for control changes
+// (controller, value) on any channel
+void Onewiremidi_set_control_change(Onewiremidi *self, callback_int_int cb) {
+  self->midi_control_change = cb;
+}
+
+// Onewiremidi_set_pitch_bend sets the callback for pitch bend, -8192..8191
+// on any channel
+void Onewiremidi_set_pitch_bend(Onewiremidi *self, callback_bend cb) {
+  self->midi_pitch_bend = cb;
+}
+
 uint8_t Onewiremidi_reverse_uint8_t(uint8_t b) {
   b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
   b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
@@ -100,67 +179,109 @@ uint8_t Onewiremidi_reverse_uint8_t(uint8_t b) {
   return b;
 }
 
-typedef struct midi_message {
-  uint8_t status;
-  uint8_t data[2];
-} midi_message;
+// Onewiremidi_data_length is the number of data bytes after status
+uint8_t Onewiremidi_data_length(uint8_t status) {
+  switch (status & 0xf0) {
+    case MIDI_PROGRAM_CHANGE:
+    case MIDI_CHANNEL_PRESSURE:
+      return 1;
+    case MIDI_SYSEX:
+      break;
+    default:
+      return 2;
+  }
+  if (status == MIDI_TIME_CODE || status == MIDI_SONG_SELECT) {
+    return 1;
+  }
+  if (status == MIDI_SONG_POSITION) {
+    return 2;
+  }
+  return 0;
+}
 
-void Onewiremidi_receive(Onewiremidi *self) {
-  if (pio_sm_is_rx_fifo_empty(self->pio, self->sm)) {
-    return;
+void Onewiremidi_realtime(Onewiremidi *self, uint8_t b, uint64_t t) {
+  if (b == MIDI_TIMING_CLOCK && self->midi_timing != NULL) {
+    self->midi_timing(t);
+  } else if (b == MIDI_START && self->midi_start != NULL) {
+    self->midi_start();
+  } else if (b == MIDI_CONTINUE && self->midi_continue != NULL) {
+    self->midi_continue();
+  } else if (b == MIDI_STOP && self->midi_stop != NULL) {
+    self->midi_stop();
   }
-  uint32_t t = time_us_32();
-  if (t - self->last_time > 1000) {
-    self->status = 0;
-    self->previous = 0;
+}
+
+void Onewiremidi_message(Onewiremidi *self) {
+  uint8_t d0 = self->data[0];
+  uint8_t d1 = self->data[1];
+  switch (self->status & 0xf0) {
+    case MIDI_NOTE_ON:
+      if (d1 > 0) {
+        if (self->midi_note_on != NULL) {
+          self->midi_note_on(d0, d1);
+        }
+        break;
+      }
+      // note on with velocity 0 is a note off
+      // fall through
+    case MIDI_NOTE_OFF:
+      if (self->midi_note_off != NULL) {
+        self->midi_note_off(d0);
+      }
+      break;
+    case MIDI_CONTROL_CHANGE:
+      if (self->midi_control_change != NULL) {
+        self->midi_control_change(d0, d1);
+      }
+      break;
+    case MIDI_PITCH_BEND:
+      if (self->midi_pitch_bend != NULL) {
+        self->midi_pitch_bend((int16_t)((d1 << 7) | d0) - 8192);
+      }
+      break;
+    default:
+      break;
   }
-  self->last_time = t;
-  uint8_t b = Onewiremidi_reverse_uint8_t(pio_sm_get(self->pio, self->sm));
-  b = ~b;
+}
 
-  enum { DATA0_PRESENT = 0x80 };
-  midi_message msg = {0};
+// Onewiremidi_receive handles the next received byte, if any. Returns false
+// once there are none left.
+bool Onewiremidi_receive(Onewiremidi *self) {
+  if (self->rx_tail == self->rx_head) {
+    return false;
+  }
+  uint8_t b = self->rx[self->rx_tail];
+  uint32_t t32 = self->rx_time[self->rx_tail];
+  self->rx_tail = (self->rx_tail + 1) & (ONEWIREMIDI_RX_SIZE - 1);
+  uint64_t now = time_us_64();
+  uint64_t t = now - (uint32_t)((uint32_t)now - t32);
+  b = Onewiremidi_reverse_uint8_t(b);
+  b = ~b;
 
   if (b >= 0xf8) {
-    msg.status = b;
-    if (msg.status == MIDI_TIMING_CLOCK && self->midi_timing != NULL) {
-      self->midi_timing();
-    } else if (msg.status == MIDI_START && self->midi_start != NULL) {
-      self->midi_start();
-    } else if (b == MIDI_CONTINUE && self->midi_continue != NULL) {
-      self->midi_continue();
-    } else if (b == MIDI_STOP && self->midi_stop != NULL) {
-      self->midi_stop();
-    }
-  } else if (b >= 0xf4) {
-    msg.status = b;
-    self->status = 0;
+    // realtime, leaves any message in progress alone
+    Onewiremidi_realtime(self, b, t);
   } else if (b >= 0x80) {
+    self->count = 0;
+    self->sysex = b == MIDI_SYSEX;
     self->status = b;
-    self->previous = b == 0xf0 ? b : 0;
-  } else if ((self->status >= 0xc0 && self->status < 0xe0) ||
-             (self->status >= 0xf0 && self->status != 0xf2)) {
-    msg.status = self->status;
-    msg.data[0] = b;
-    msg.data[1] = self->previous;
-    self->previous = 0;
-  } else if (self->status && self->previous & DATA0_PRESENT) {
-    msg.status = self->status;
-    msg.data[0] = self->previous ^ DATA0_PRESENT;
-    msg.data[1] = b;
-    self->previous = 0;
-    if (msg.status == MIDI_NOTE_ON) {
-      if (self->midi_note_on != NULL) {
-        self->midi_note_on(msg.data[0], msg.data[1]);
-      }
-    } else if (msg.status == MIDI_NOTE_OFF) {
-      if (self->midi_note_off != NULL) {
-        self->midi_note_off(msg.data[0]);
+    if (b >= MIDI_SYSEX && Onewiremidi_data_length(b) == 0) {
+      // tune request, sysex end or undefined: nothing follows
+      self->status = 0;
+    }
+  } else if (self->status != 0 && !self->sysex) {
+    self->data[self->count++] = b;
+    if (self->count == Onewiremidi_data_length(self->status)) {
+      self->count = 0;
+      self->time = t;
+      Onewiremidi_message(self);
+      if (self->status >= MIDI_SYSEX) {
+        // only channel messages have running status
+        self->status = 0;
       }
     }
-  } else {
-    self->previous = b | DATA0_PRESENT;
   }
+  // data bytes without a status, or inside sysex, are skipped
 
-  return;
+  return true;
 }
@@ -0,0 +1,132 @@
+"""Report where the firmware's code and data end up and how large they are.
+
+Reads the symbol table of the linked ELF (objdump -t) and sorts every symbol
+by the memory its run address falls in: XIP flash, the striped SRAM banks or
+the scratch X/Y banks. Functions marked __not_in_flash_func and tables marked
+__not_in_flash run from SRAM, __scratch_x data lives in scratch X.
+
+    python3 doth/placement_report.py arm-none-eabi-objdump pikocore.elf \
+        pikocore.placement.txt --ram audio_interrupt_handler ClockOut::Tick
+
+The summary goes to stdout, the full list per region to the output file.
+Every symbol named after --ram is checked to be outside flash, a warning
+names those that are not. The report fails (exit 1) if the firmware image,
+which ends at __flash_binary_end, runs into the settings region that starts
+at __settings_offset.
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+
+# RP2040 address map
+REGIONS = [
+    ("flash", 0x10000000, 0x11000000),
+    ("sram", 0x20000000, 0x20040000),
+    ("scratch_x", 0x20040000, 0x20041000),
+    ("scratch_y", 0x20041000, 0x20042000),
+]
+
+# 20000110 g     F .data	0000013c audio_interrupt_handler()
+SYMBOL = re.compile(r"^([0-9a-f]{8}) (.{7}) (\S+)\s+([0-9a-f]{8}) (.+)$")
+
+
+def region_of(addr):
+    for name, start, end in REGIONS:
+        if start <= addr < end:
+            return name
+    return None
+
+
+def matches(want, symbol):
+    # demangled "I2SAudio::WriteSample(unsigned char)" matches "WriteSample"
+    # and "I2SAudio::WriteSample"
+    name = symbol.split("(")[0]
+    return name == want or name.endswith("::" + want)
+
+
+def read_symbols(objdump, elf):
+    out = subprocess.run(
+        [objdump, "-t", "-C", elf], check=True, capture_output=True, text=True
+    ).stdout
+    symbols = {}
+    values = {}
+    for line in out.splitlines():
+        m = SYMBOL.match(line)
+        if m is None:
+            continue
+        addr, flags, section, size, name = m.groups()
+        values[name] = int(addr, 16)
+        size = int(size, 16)
+        region = region_of(int(addr, 16))
+        kind = "code" if "F" in flags else "data"
+        # assembly functions such as the SDK's divider carry no size, they
+        # are kept so --ram can find them
+        if region is None or (size == 0 and kind == "data"):
+            continue
+        # a symbol can be listed twice (local and global aliases)
+        symbols[(int(addr, 16), name)] = (region, kind, section, size, name)
+    return list(symbols.values()), values
+
+
+def check_layout(values):
+    # __settings_offset is an absolute symbol holding a flash offset
+    if "__flash_binary_end" not in values or "__settings_offset" not in values:
+        return None
+    image_end = values["__flash_binary_end"] - REGIONS[0][1]
+    settings = values["__settings_offset"]
+    if image_end > settings:
+        return "error: firmware image ends at %d, past the settings at %d" % (
+            image_end,
+            settings,
+        )
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("objdump")
+    parser.add_argument("elf")
+    parser.add_argument("output")
+    parser.add_argument("--ram", nargs="*", default=[])
+    args = parser.parse_args()
+
+    symbols, values = read_symbols(args.objdump, args.elf)
+    layout_error = check_layout(values)
+
+    totals = {}
+    for region, kind, _, size, _ in symbols:
+        t = totals.setdefault(region, {"code": 0, "data": 0})
+        t[kind] += size
+
+    lines = ["%-10s %8s %8s" % ("region", "code", "data")]
+    for name, _, _ in REGIONS:
+        t = totals.get(name, {"code": 0, "data": 0})
+        lines.append("%-10s %8d %8d" % (name, t["code"], t["data"]))
+
+    for want in args.ram:
+        placed = [s for s in symbols if matches(want, s[4])]
+        if not placed:
+            lines.append("note: %s not found, inlined or unused" % want)
+        for region, _, _, _, name in placed:
+            if region == "flash":
+                lines.append("warning: %s is in flash" % name)
+
+    print("\n".join(lines))
+    with open(args.output, "w") as f:
+        f.write("\n".join(lines) + "\n")
+        for name, _, _ in REGIONS:
+            f.write("\n%s\n" % name)
+            for _, kind, section, size, symbol in sorted(
+                (s for s in symbols if s[0] == name), key=lambda s: -s[3]
+            ):
+                f.write("  %8d %-4s %-24s %s\n" % (size, kind, section, symbol))
+    if layout_error is not None:
+        print(layout_error, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,156 @@
+// SampleBank - sample directory parsed from flash at boot
+//
+// A bank is a self-describing image written by audio2h (doth/audio2h.bin,
+// or a samples-only UF2 flashed at SAMPLE_BANK_OFFSET):
+//
+//   SampleBankHeader               16 bytes
+//   SampleBankEntry[count]         20 bytes each
+//   slice tables                   uint32_t per beat, offsets into the sample
+//   sample data                    8-bit unsigned, offsets from bank start
+//
+// All fields are little-endian. Load() validates the header, every entry and
+// every slice against the bank size and copies the directory into RAM, so the
+// audio interrupt only reads flash for the audio and a single slice offset.
+//
+// Slices are where each beat starts, moved by audio2h onto the nearest
+// transient so jumps land on the hit instead of a few ms around it.
+
+#ifndef SAMPLE_BANK_H
+#define SAMPLE_BANK_H
+
+#include <stdint.h>
+
+#define SAMPLE_BANK_MAGIC 0x42534B50  // "PKSB"
+#define SAMPLE_BANK_VERSION 4
+#define SAMPLE_BANK_MAX 128
+
+typedef struct SampleBankHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t samples_per_beat;  // eighth note, every sample is at BPM_SAMPLED
+  uint32_t size;  // header + directory + data, in bytes
+} SampleBankHeader;
+
+typedef struct SampleBankEntry {
+  uint32_t offset;  // from the start of the bank
+  uint32_t len;
+  uint32_t rate;
+  uint16_t beats;  // eighth notes
+  uint16_t reserved;
+  uint32_t slices;  // from the start of the bank, 0 for a plain beat grid
+} SampleBankEntry;
+
+class SampleBank {
+  const uint8_t *base;
+  uint16_t count;
+  uint32_t samples_per_beat;
+  SampleBankEntry table[SAMPLE_BANK_MAX];
+
+ public:
+  // Load parses the bank at base_ and returns false (keeping any previously
+  // loaded bank) if it is missing, from another firmware build or corrupt
+  bool Load(const uint8_t *base_, uint32_t max_size) {
+    const SampleBankHeader *h = (const SampleBankHeader *)base_;
+    if (h->magic != SAMPLE_BANK_MAGIC || h->version != SAMPLE_BANK_VERSION) {
+      return false;
+    }
+    if (h->count == 0 || h->count > SAMPLE_BANK_MAX || h->size > max_size ||
+        h->samples_per_beat == 0) {
+      return false;
+    }
+    uint32_t data_start =
+        sizeof(SampleBankHeader) + h->count * sizeof(SampleBankEntry);
+    if (data_start > h->size) {
+      return false;
+    }
+    const SampleBankEntry *e =
+        (const SampleBankEntry *)(base_ + sizeof(SampleBankHeader));
+    for (uint16_t i = 0; i < h->count; i++) {
+      if (e[i].len == 0 || e[i].beats == 0 || e[i].rate != SAMPLE_RATE ||
+          e[i].offset < data_start || e[i].offset > h->size ||
+          e[i].len > h->size - e[i].offset) {
+        return false;
+      }
+      if (e[i].slices != 0) {
+        if (e[i].slices % 4 != 0 || e[i].slices > h->size ||
+            e[i].beats * 4 > h->size - e[i].slices) {
+          return false;
+        }
+        const uint32_t *slices = (const uint32_t *)(base_ + e[i].slices);
+        for (uint16_t j = 0; j < e[i].beats; j++) {
+          if (slices[j] >= e[i].len) {
+            return false;
+          }
+        }
+      }
+    }
+    for (uint16_t i = 0; i < h->count; i++) {
+      table[i] = e[i];
+    }
+    base = base_;
+    count = h->count;
+    samples_per_beat = h->samples_per_beat;
+    return true;
+  }
+
+  void Clear() { count = 0; }
+
+  bool Loaded() { return count > 0; }
+
+  // with no bank loaded there is a single silent sample so the engine's
+  // modulo arithmetic stays defined
+  uint16_t __not_in_flash_func(Count)() { return count > 0 ? count : 1; }
+
+  // Val, Len, Beats, Slice and Count above are read by the audio interrupt and
+  // run from RAM
+  uint8_t __not_in_flash_func(Val)(uint16_t s, uint32_t i) {
+    if (s >= count) {
+      return 128;
+    }
+    return base[table[s].offset + i];
+  }
+
+  uint32_t __not_in_flash_func(Len)(uint16_t s) {
+    if (s >= count) {
+      return SAMPLES_PER_BEAT;
+    }
+    return table[s].len;
+  }
+
+  uint16_t __not_in_flash_func(Beats)(uint16_t s) {
+    if (s >= count) {
+      return 1;
+    }
+    return table[s].beats;
+  }
+
+  // Slice returns where a beat (below Beats(s)) starts inside the sample
+  uint32_t __not_in_flash_func(Slice)(uint16_t s, uint16_t beat) {
+    if (s >= count) {
+      return 0;
+    }
+    if (table[s].slices == 0) {
+      return (beat * samples_per_beat) % table[s].len;
+    }
+    return ((const uint32_t *)(base + table[s].slices))[beat % table[s].beats];
+  }
+
+  // SamplesPerBeat is the eighth note the bank was converted at, which is
+  // SAMPLES_PER_BEAT unless the partition holds a bank from another build
+  uint32_t __not_in_flash_func(SamplesPerBeat)() {
+    if (count == 0) {
+      return SAMPLES_PER_BEAT;
+    }
+    return samples_per_beat;
+  }
+
+  uint32_t Rate(uint16_t s) {
+    if (s >= count) {
+      return SAMPLE_RATE;
+    }
+    return table[s].rate;
+  }
+};
+
+#endif
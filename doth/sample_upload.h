@@ -0,0 +1,194 @@
+// SampleUpload - write a sample bank to the sample partition over USB
+//
+// The host (audio2h/upload.py) sends on the vendor bulk interface:
+//
+//   uint32_t magic  SAMPLE_UPLOAD_MAGIC
+//   uint32_t size   bank size in bytes
+//   uint8_t  bank[size]
+//
+// and gets back three uint32_t: magic, status (SAMPLE_UPLOAD_*) and the
+// measured throughput in KB/s. All fields are little-endian.
+//
+// Bytes are staged in two RAM buffers: one fills from USB while the other is
+// programmed. Erases run one erase block ahead of the programming position,
+// so a 64 KB block erase is usually done before its first chunk arrives. Only
+// one flash operation runs per Task() so tud_task keeps being serviced, and
+// the bytes that arrive meanwhile wait in the TinyUSB FIFO (the host is NAKed
+// when it is full). Audio must be muted while Active(): the partition is
+// half-written and XIP is unavailable during every erase/program.
+
+#ifndef SAMPLE_UPLOAD_H
+#define SAMPLE_UPLOAD_H
+
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+
+#define SAMPLE_UPLOAD_MAGIC 0x50554B50  // "PKUP"
+#define SAMPLE_UPLOAD_CHUNK FLASH_SECTOR_SIZE
+#define SAMPLE_UPLOAD_ERASE (1u << 16)  // block erase, much faster per byte
+
+#define SAMPLE_UPLOAD_OK 0
+#define SAMPLE_UPLOAD_TOO_BIG 1
+#define SAMPLE_UPLOAD_BAD_BANK 2
+
+class SampleUpload {
+  uint32_t offset;
+  uint32_t max_size;
+  uint8_t stage[2][SAMPLE_UPLOAD_CHUNK];
+  uint16_t stage_len[2];
+  bool stage_full[2];
+  uint8_t filling;
+  uint8_t programming;
+  uint8_t command[8];
+  uint8_t command_len;
+  bool active;
+  bool done;
+  uint32_t size;
+  uint32_t received;
+  uint32_t programmed;
+  uint32_t erased;
+  uint64_t start_us;
+
+  void Erase() {
+    uint32_t n = SAMPLE_UPLOAD_ERASE;
+    uint32_t end = (size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    if (erased % SAMPLE_UPLOAD_ERASE != 0 || end - erased < n) {
+      n = FLASH_SECTOR_SIZE;
+    }
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(offset + erased, n);
+    restore_interrupts(ints);
+    erased += n;
+  }
+
+  void Program() {
+    uint8_t b = programming;
+    // the tail is padded to a whole page with erased flash
+    uint32_t len = (stage_len[b] + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+    for (uint32_t i = stage_len[b]; i < len; i++) {
+      stage[b][i] = 0xff;
+    }
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(offset + programmed, stage[b], len);
+    restore_interrupts(ints);
+    programmed += stage_len[b];
+    stage_len[b] = 0;
+    stage_full[b] = false;
+    programming = 1 - programming;
+  }
+
+  void Reply(uint32_t status, uint32_t kbps) {
+    uint32_t reply[3] = {SAMPLE_UPLOAD_MAGIC, status, kbps};
+    tud_vendor_write(reply, sizeof(reply));
+    tud_vendor_write_flush();
+  }
+
+  void Start() {
+    size = command[4] | (command[5] << 8) | (command[6] << 16) |
+           ((uint32_t)command[7] << 24);
+    command_len = 0;
+    if (size == 0 || size > max_size) {
+      printf("upload: %lu bytes does not fit in %lu\n", size, max_size);
+      Reply(SAMPLE_UPLOAD_TOO_BIG, 0);
+      return;
+    }
+    received = 0;
+    programmed = 0;
+    erased = 0;
+    filling = 0;
+    programming = 0;
+    stage_len[0] = stage_len[1] = 0;
+    stage_full[0] = stage_full[1] = false;
+    start_us = time_us_64();
+    active = true;
+    done = false;
+    printf("upload: receiving %lu bytes\n", size);
+  }
+
+  // Receive moves bytes from the USB FIFO into the staging buffer being
+  // filled, and leaves them in the FIFO while both buffers wait for flash
+  void Receive() {
+    while (tud_vendor_available() > 0) {
+      if (!active) {
+        command_len += tud_vendor_read(&command[command_len],
+                                       sizeof(command) - command_len);
+        if (command_len < sizeof(command)) {
+          continue;
+        }
+        uint32_t magic = command[0] | (command[1] << 8) | (command[2] << 16) |
+                         ((uint32_t)command[3] << 24);
+        if (magic != SAMPLE_UPLOAD_MAGIC) {
+          // resynchronise on the next byte
+          memmove(command, command + 1, sizeof(command) - 1);
+          command_len--;
+          continue;
+        }
+        Start();
+        continue;
+      }
+      uint8_t b = filling;
+      if (stage_full[b] || received == size) {
+        return;
+      }
+      uint32_t want = SAMPLE_UPLOAD_CHUNK - stage_len[b];
+      if (want > size - received) {
+        want = size - received;
+      }
+      uint32_t n = tud_vendor_read(&stage[b][stage_len[b]], want);
+      stage_len[b] += n;
+      received += n;
+      if (stage_len[b] == SAMPLE_UPLOAD_CHUNK || received == size) {
+        stage_full[b] = true;
+        filling = 1 - filling;
+      }
+    }
+  }
+
+ public:
+  void Init(uint32_t offset_, uint32_t max_size_) {
+    offset = offset_;
+    max_size = max_size_;
+    active = false;
+    done = false;
+    command_len = 0;
+  }
+
+  bool __not_in_flash_func(Active)() { return active; }
+
+  // Done is true when the whole bank is in flash. The upload stays Active()
+  // (audio muted) until Finish() so the bank can be reloaded first.
+  bool Done() { return active && done; }
+
+  // Finish reports the result to the host after the bank has been checked
+  void Finish(bool bank_ok) {
+    active = false;
+    done = false;
+    uint32_t us = (uint32_t)(time_us_64() - start_us);
+    uint32_t kbps = us > 0 ? (uint32_t)((uint64_t)size * 1000000 / 1024 / us)
+                           : 0;
+    printf("upload: %lu bytes in %lu ms, %lu KB/s\n", size, us / 1000, kbps);
+    Reply(bank_ok ? SAMPLE_UPLOAD_OK : SAMPLE_UPLOAD_BAD_BANK, kbps);
+  }
+
+  // Task runs at most one flash operation, call it from the main loop after
+  // tud_task
+  void Task() {
+    Receive();
+    if (!active || done) {
+      return;
+    }
+    uint32_t end = programmed + stage_len[programming];
+    if (stage_full[programming] && end <= erased) {
+      Program();
+    } else if (erased < size && erased < programmed + SAMPLE_UPLOAD_ERASE) {
+      // keep one erase block ahead of the chunk being programmed
+      Erase();
+    }
+    if (programmed == size) {
+      done = true;
+    }
+  }
+};
+
+#endif
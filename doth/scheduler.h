@@ -0,0 +1,150 @@
+// Scheduler - cooperative tasks at fixed periods for the main loop
+//
+// Each task has a period in microseconds and a deadline. Wait() sleeps in
+// __wfi() until the earliest deadline, woken by a hardware alarm set to it
+// (or earlier by any other interrupt, the audio timer included). A task
+// runs when Due() says so, inside the loop body that already owns its
+// state:
+//
+//   scheduler.Init();
+//   scheduler.Add(TASK_BUTTONS, "buttons", 4000);  // 250 Hz
+//   while (1) {
+//     scheduler.Wait();
+//     if (scheduler.Due(TASK_BUTTONS)) {
+//       ...
+//       scheduler.Done(TASK_BUTTONS);
+//     }
+//   }
+//
+// Deadlines advance by the period, not from when the task ran, so cadences
+// do not drift with the loop body's runtime. A task that is a whole period
+// or more late skips the missed runs and counts them as overruns, and the
+// longest run and lateness of every task are kept for Print().
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+#define SCHEDULER_MAX_TASKS 8
+
+class Scheduler {
+  struct Task {
+    const char *name;
+    uint32_t period_us;
+    uint64_t next_us;
+    uint64_t start_us;
+    uint32_t runs;
+    uint32_t overruns;  // runs skipped because the task was a period late
+    uint32_t late_max_us;
+    uint32_t run_max_us;
+  };
+
+  Task tasks[SCHEDULER_MAX_TASKS];
+  uint8_t count;
+  int alarm;
+
+  // the alarm only has to wake the core from __wfi()
+  static void AlarmCallback(uint alarm_num) {}
+
+ public:
+  void Init() {
+    count = 0;
+    for (uint8_t i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+      tasks[i].period_us = 0;
+    }
+    alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(alarm, AlarmCallback);
+  }
+
+  // Add a task with id below SCHEDULER_MAX_TASKS, first due right away
+  void Add(uint8_t id, const char *name, uint32_t period_us) {
+    if (id >= SCHEDULER_MAX_TASKS) {
+      return;
+    }
+    Task &t = tasks[id];
+    t.name = name;
+    t.period_us = period_us;
+    t.next_us = time_us_64();
+    t.runs = 0;
+    t.overruns = 0;
+    t.late_max_us = 0;
+    t.run_max_us = 0;
+    if (id >= count) {
+      count = id + 1;
+    }
+  }
+
+  // Wait sleeps until the earliest task is due
+  void Wait() {
+    uint64_t next = UINT64_MAX;
+    for (uint8_t i = 0; i < count; i++) {
+      if (tasks[i].period_us > 0 && tasks[i].next_us < next) {
+        next = tasks[i].next_us;
+      }
+    }
+    if (next == UINT64_MAX ||
+        hardware_alarm_set_target(alarm, from_us_since_boot(next))) {
+      return;  // nothing scheduled, or already due
+    }
+    while (time_us_64() < next) {
+      __wfi();
+    }
+  }
+
+  // Due returns true if the task should run now, and schedules its next run
+  bool Due(uint8_t id) {
+    Task &t = tasks[id];
+    uint64_t now = time_us_64();
+    if (t.period_us == 0 || now < t.next_us) {
+      return false;
+    }
+    uint32_t late = now - t.next_us;
+    if (late > t.late_max_us) {
+      t.late_max_us = late;
+    }
+    if (late >= t.period_us) {
+      t.overruns += late / t.period_us;
+      t.next_us = now + t.period_us;
+    } else {
+      t.next_us += t.period_us;
+    }
+    t.runs++;
+    t.start_us = now;
+    return true;
+  }
+
+  // Done ends the run started by Due(), for the runtime accounting
+  void Done(uint8_t id) {
+    Task &t = tasks[id];
+    uint32_t run = time_us_64() - t.start_us;
+    if (run > t.run_max_us) {
+      t.run_max_us = run;
+    }
+  }
+
+  uint32_t Overruns(uint8_t id) { return tasks[id].overruns; }
+
+  // Print the accounting of every task and start it over
+  void Print() {
+    for (uint8_t i = 0; i < count; i++) {
+      Task &t = tasks[i];
+      if (t.period_us == 0) {
+        continue;
+      }
+      printf("%-10s %6lu us: %6lu runs, %4lu overruns, late max %5lu us, "
+             "run max %5lu us\n",
+             t.name, t.period_us, t.runs, t.overruns, t.late_max_us,
+             t.run_max_us);
+      t.runs = 0;
+      t.overruns = 0;
+      t.late_max_us = 0;
+      t.run_max_us = 0;
+    }
+  }
+};
+
+#endif
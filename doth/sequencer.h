@@ -42,14 +42,14 @@ class Sequencer {
     }
   }
 
-  void Record(uint8_t v) {
-    if (isRecording) {
+  void __not_in_flash_func(Record)(uint8_t v) {
+    if (isRecording && len < 128) {
       mem[len] = v;
       len++;
     }
   }
 
-  bool IsPlaying() { return isPlaying && len > 0; }
+  bool __not_in_flash_func(IsPlaying)() { return isPlaying && len > 0; }
   bool IsRecording() { return isRecording; }
 
   void SetRecording(bool on) {
@@ -71,12 +71,17 @@ class Sequencer {
     return 255;
   }
 
-  uint8_t Next(uint32_t beat) {
+  uint8_t __not_in_flash_func(Next)(uint32_t beat) {
     if (isPlaying && len > 0) {
       return mem[beat % len];
     } else {
       return 0;
     }
   }
-  uint8_t NextI(uint32_t beat) { return beat % len; }
+  uint8_t __not_in_flash_func(NextI)(uint32_t beat) {
+    if (len == 0) {
+      return 0;
+    }
+    return beat % len;
+  }
 };
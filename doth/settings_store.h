@@ -0,0 +1,198 @@
+// SettingsStore - settings as a log of records in a ring of flash sectors
+//
+// Every Save() programs one record into the next free page after the newest
+// one, so a save costs a page program instead of a sector erase. Only when
+// the log runs into the next sector is that sector (holding the oldest
+// records) erased first. Wear is spread over SETTINGS_SECTORS sectors with
+// one erase every 16 saves, and a power cut during a save only ever loses
+// the record being written: the one before it is still in flash.
+//
+// A record fills a page: a magic, the layout version, a sequence number
+// counting up with every save, the settings and a CRC-32 over all of it.
+// Load() indexes the sectors by the sequence of their first record, then
+// scans the newest sector backwards for the last record with a good CRC.
+//
+// The sectors must lie past the end of the firmware image: Init() is given
+// both and leaves the store disabled if they overlap, so that Load() finds
+// nothing and Save() refuses to erase what would be code.
+//
+//   settings_store.Init(SETTINGS_OFFSET, flash_image_end());
+//   if (settings_store.Load(save_data)) {
+//     ...
+//   }
+//   bool long_write = settings_store.WillErase();
+//   uint32_t ints = save_and_disable_interrupts();
+//   bool saved = settings_store.Save(save_data);
+//   restore_interrupts(ints);
+
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+
+#define SETTINGS_MAGIC 0x54534B50  // "PKST"
+#define SETTINGS_VERSION 1
+#define SETTINGS_SECTORS 4
+#define SETTINGS_DATA_SIZE 240
+#define SETTINGS_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define SETTINGS_SLOTS (SETTINGS_SECTORS * SETTINGS_PAGES_PER_SECTOR)
+
+typedef struct SettingsRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  uint32_t sequence;
+  uint8_t data[SETTINGS_DATA_SIZE];
+  uint32_t crc;  // of everything before it
+} SettingsRecord;
+
+static_assert(sizeof(SettingsRecord) == FLASH_PAGE_SIZE,
+              "a settings record fills one flash page");
+
+class SettingsStore {
+  uint32_t offset;    // of the first sector, from the start of flash
+  bool enabled;       // false if the sectors overlap the firmware image
+  int16_t newest;     // slot of the newest record, -1 if there is none
+  uint32_t sequence;  // of the newest record
+
+  const SettingsRecord *Slot(uint16_t slot) {
+    return (const SettingsRecord *)(uintptr_t)(XIP_BASE + offset +
+                                               slot * FLASH_PAGE_SIZE);
+  }
+
+  static uint32_t Crc32(const uint8_t *buf, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < len; i++) {
+      crc ^= buf[i];
+      for (uint8_t b = 0; b < 8; b++) {
+        crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+      }
+    }
+    return ~crc;
+  }
+
+  bool Valid(uint16_t slot) {
+    const SettingsRecord *r = Slot(slot);
+    return r->magic == SETTINGS_MAGIC && r->version == SETTINGS_VERSION &&
+           r->size == SETTINGS_DATA_SIZE &&
+           r->crc == Crc32((const uint8_t *)r, offsetof(SettingsRecord, crc));
+  }
+
+  bool Blank(uint16_t slot) {
+    const uint32_t *w = (const uint32_t *)Slot(slot);
+    for (uint16_t i = 0; i < FLASH_PAGE_SIZE / 4; i++) {
+      if (w[i] != 0xFFFFFFFF) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // NextSlot is the next page after the newest that is still erased, or
+  // the first page of the sector after; a page left half written by a
+  // power cut is skipped
+  uint16_t NextSlot() {
+    uint16_t slot = newest < 0 ? 0 : (newest + 1) % SETTINGS_SLOTS;
+    while (slot % SETTINGS_PAGES_PER_SECTOR != 0 && !Blank(slot)) {
+      slot = (slot + 1) % SETTINGS_SLOTS;
+    }
+    return slot;
+  }
+
+ public:
+  // Init finds the newest record in the SETTINGS_SECTORS sectors at offset_.
+  // image_end is where the firmware image ends, from the start of flash.
+  void Init(uint32_t offset_, uint32_t image_end) {
+    offset = offset_;
+    enabled = image_end <= offset_;
+    newest = -1;
+    sequence = 0;
+    if (!enabled) {
+      return;
+    }
+    // index: the sector whose first record is newest holds the newest
+    // record, unless that sector has none that is valid
+    int16_t order[SETTINGS_SECTORS];
+    uint8_t n = 0;
+    for (uint8_t s = 0; s < SETTINGS_SECTORS; s++) {
+      uint16_t first = s * SETTINGS_PAGES_PER_SECTOR;
+      if (!Valid(first)) {
+        continue;
+      }
+      uint8_t j = n++;
+      while (j > 0 && Slot(order[j - 1])->sequence < Slot(first)->sequence) {
+        order[j] = order[j - 1];
+        j--;
+      }
+      order[j] = first;
+    }
+    for (uint8_t i = 0; i < n && newest < 0; i++) {
+      for (int16_t slot = order[i] + SETTINGS_PAGES_PER_SECTOR - 1;
+           slot >= order[i]; slot--) {
+        if (Valid(slot)) {
+          newest = slot;
+          sequence = Slot(slot)->sequence;
+          break;
+        }
+      }
+    }
+  }
+
+  // Load copies the newest settings into data, returns false if there are
+  // none
+  bool Load(uint8_t data[FLASH_PAGE_SIZE]) {
+    if (newest < 0) {
+      return false;
+    }
+    memcpy(data, Slot(newest)->data, SETTINGS_DATA_SIZE);
+    memset(data + SETTINGS_DATA_SIZE, 0, FLASH_PAGE_SIZE - SETTINGS_DATA_SIZE);
+    return true;
+  }
+
+  // Save appends data as the newest record, returns false if the store is
+  // disabled. It erases and programs flash, so call it with interrupts
+  // disabled.
+  bool Save(const uint8_t data[FLASH_PAGE_SIZE]) {
+    if (!enabled) {
+      return false;
+    }
+    uint16_t slot = NextSlot();
+    if (slot % SETTINGS_PAGES_PER_SECTOR == 0) {
+      flash_range_erase(offset + slot * FLASH_PAGE_SIZE, FLASH_SECTOR_SIZE);
+    }
+
+    SettingsRecord r;
+    r.magic = SETTINGS_MAGIC;
+    r.version = SETTINGS_VERSION;
+    r.size = SETTINGS_DATA_SIZE;
+    r.sequence = sequence + 1;
+    memcpy(r.data, data, SETTINGS_DATA_SIZE);
+    r.crc = Crc32((const uint8_t *)&r, offsetof(SettingsRecord, crc));
+    flash_range_program(offset + slot * FLASH_PAGE_SIZE, (const uint8_t *)&r,
+                        FLASH_PAGE_SIZE);
+    newest = slot;
+    sequence = r.sequence;
+    return true;
+  }
+
+  // WillErase is true if the next Save() erases a sector before it
+  // programs, which takes up to ~400 ms instead of ~3 ms
+  bool WillErase() {
+    return enabled && NextSlot() % SETTINGS_PAGES_PER_SECTOR == 0;
+  }
+
+  // Enabled is false if the sectors overlap the firmware image
+  bool Enabled() { return enabled; }
+
+  // Sequence counts the saves, 0 before the first
+  uint32_t Sequence() { return sequence; }
+
+  // Newest is the slot of the newest record, -1 if there is none
+  int16_t Newest() { return newest; }
+};
+
+#endif
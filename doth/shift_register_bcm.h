@@ -0,0 +1,112 @@
+#ifndef SHIFT_REGISTER_BCM_H
+#define SHIFT_REGISTER_BCM_H
+
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "pico/stdlib.h"
+#include "shift_register_bcm.pio.h"
+
+// 74HC595 Shift Register Driver with 8-bit brightness per output
+// Two cascaded shift registers, same bit order as ShiftRegister
+//
+// Brightness uses binary code modulation: bit b of every output's brightness
+// forms a bit-plane that is shown for BCM_UNIT << b PIO cycles. A PIO program
+// (shift_register_bcm.pio) clocks the planes into the chain and latches them,
+// and a DMA channel loops over the 8 planes of the frame buffer, so the
+// refresh rate is fixed and no CPU time is spent once the frame is built.
+//
+// At 10 MHz PIO clock and BCM_UNIT = 64 a frame takes 255 * 64 cycles,
+// a 613 Hz refresh. SRCLK runs at 5 MHz.
+class ShiftRegisterBCM {
+ private:
+  static const uint32_t PIO_HZ = 10000000;
+  static const uint32_t BCM_UNIT = 64;  // cycles of the least significant plane
+  static const uint8_t PLANES = 8;
+  static const uint8_t FRAME_BITS = 5;  // 8 words = 32 bytes, DMA read wrap
+
+  PIO pio;
+  uint sm;
+  int dma_chan;
+  uint8_t level[16];  // brightness per output bit
+  bool dirty;
+
+  // read by DMA, aligned for the DMA address wrap
+  uint32_t frame[PLANES] __attribute__((aligned(1 << FRAME_BITS)));
+
+  void Build() {
+    for (uint8_t b = 0; b < PLANES; b++) {
+      uint32_t plane = 0;
+      for (uint8_t i = 0; i < 16; i++) {
+        if ((level[i] >> b) & 0x01) {
+          plane |= (1 << i);
+        }
+      }
+      // one word per plane, the DMA may be reading any of them
+      frame[b] = (plane << 16) |
+                 ((BCM_UNIT << b) - shift_register_bcm_OVERHEAD);
+    }
+    dirty = false;
+  }
+
+ public:
+  // Initialize PIO and DMA, rclk_pin must be srclk_pin + 1 (side-set)
+  void Init(PIO pio_, uint8_t ser_pin, uint8_t srclk_pin, uint8_t rclk_pin) {
+    pio = pio_;
+    sm = pio_claim_unused_sm(pio, true);
+    for (uint8_t i = 0; i < 16; i++) {
+      level[i] = 0;
+    }
+    Build();
+
+    uint offset = pio_add_program(pio, &shift_register_bcm_program);
+    shift_register_bcm_program_init(pio, sm, offset, ser_pin, srclk_pin,
+                                    (float)clock_get_hz(clk_sys) / PIO_HZ);
+
+    dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config cfg = dma_channel_get_default_config(dma_chan);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_ring(&cfg, false, FRAME_BITS);
+    channel_config_set_dreq(&cfg, pio_get_dreq(pio, sm, true));
+    // the largest count lasts ~10 days at 613 Hz, Update() restarts it
+    dma_channel_configure(dma_chan, &cfg, &pio->txf[sm], frame, 0xFFFFFFFF,
+                          true);
+  }
+
+  // Set brightness (0-255) of an output bit (updates internal state only)
+  void Set(uint8_t bit_index, uint8_t brightness) {
+    if (bit_index < 16 && level[bit_index] != brightness) {
+      level[bit_index] = brightness;
+      dirty = true;
+    }
+  }
+
+  uint8_t Get(uint8_t bit_index) {
+    if (bit_index < 16) {
+      return level[bit_index];
+    }
+    return 0;
+  }
+
+  // Update rebuilds the frame if any brightness changed, cheap to call often
+  void Update() {
+    if (dirty) {
+      Build();
+    }
+    if (!dma_channel_is_busy(dma_chan)) {
+      dma_channel_set_trans_count(dma_chan, 0xFFFFFFFF, true);
+    }
+  }
+
+  // Clear all outputs
+  void Clear() {
+    for (uint8_t i = 0; i < 16; i++) {
+      Set(i, 0);
+    }
+    Update();
+  }
+};
+
+#endif  // SHIFT_REGISTER_BCM_H
@@ -0,0 +1,158 @@
+// TempoPLL - phase-locked loop on the positions of external clock edges
+//
+// Edges come in as free-running tick counts (audio samples here). The loop
+// predicts where the next edge should land from its period and phase
+// estimates, and corrects both by a fraction of the error when it arrives:
+// the phase by 1/2^kp_shift and the period by 1/2^ki_shift (an alpha-beta
+// filter, i.e. a second order PLL). Larger shifts smooth more jitter but
+// follow tempo changes slower, a clock with many edges per beat can afford
+// them. Jitter on single edges is
+// averaged out and a steady tempo is followed without drift. Period and
+// phase are kept in 16.16 fixed point so tempos between whole samples per
+// edge are exact.
+//
+// Missed edges are bridged by counting whole periods, and after a gap of
+// more than TEMPO_PLL_GAP periods the phase starts over at the new edge. One
+// edge far off the prediction is ignored as a glitch; TEMPO_PLL_OUTLIERS in
+// a row mean the tempo changed and the loop restarts from the last interval.
+// Edges whose time is not known (several read at once) are counted with
+// Coast(), which moves the phase on by one period without correcting it.
+// Locked() is true once TEMPO_PLL_LOCK_EDGES edges in a row landed within
+// 1/2^TEMPO_PLL_LOCK_SHIFT of a period of the prediction, and stays true
+// through jitter until an outlier.
+
+#ifndef TEMPO_PLL_H
+#define TEMPO_PLL_H
+
+#include <stdint.h>
+
+#define TEMPO_PLL_KP_SHIFT 2    // default phase gain 1/4
+#define TEMPO_PLL_KI_SHIFT 5    // default period gain 1/32
+#define TEMPO_PLL_LOCK_SHIFT 3  // locks within 1/8 of a period
+#define TEMPO_PLL_LOCK_EDGES 4
+#define TEMPO_PLL_OUTLIERS 2
+#define TEMPO_PLL_GAP 4
+
+class TempoPLL {
+  int64_t period;     // ticks per edge, 16.16
+  uint32_t phase;     // tick of the last edge estimate
+  uint16_t phase_frac;
+  int32_t error;      // last edge minus its prediction, in ticks
+  uint32_t edges;
+  uint8_t good;       // edges in a row within the lock window
+  uint8_t outliers;   // edges in a row far off the prediction
+  uint32_t last;      // tick of the last edge as it came in
+  uint16_t coasted;   // edges without a time since then
+  uint8_t kp_shift;
+  uint8_t ki_shift;
+
+  void Restart(uint32_t t, int64_t period_) {
+    period = period_;
+    phase = t;
+    phase_frac = 0;
+    good = 0;
+    outliers = 0;
+  }
+
+ public:
+  void Init(uint8_t kp_shift_ = TEMPO_PLL_KP_SHIFT,
+            uint8_t ki_shift_ = TEMPO_PLL_KI_SHIFT) {
+    kp_shift = kp_shift_;
+    ki_shift = ki_shift_;
+    Reset();
+  }
+
+  // Reset forgets the tempo, the next two edges measure it again
+  void Reset() {
+    period = 0;
+    phase = 0;
+    phase_frac = 0;
+    error = 0;
+    edges = 0;
+    good = 0;
+    outliers = 0;
+    last = 0;
+    coasted = 0;
+  }
+
+  // Update takes the tick of a new edge
+  void Update(uint32_t t) {
+    uint32_t interval = (t - last) / (coasted + 1);
+    last = t;
+    coasted = 0;
+    edges++;
+    if (edges == 1) {
+      phase = t;
+      return;
+    }
+    if (period == 0) {
+      Restart(t, (int64_t)interval << 16);
+      return;
+    }
+
+    // ticks since the last estimate, in whole periods plus the error
+    int64_t since = ((int64_t)(int32_t)(t - phase) << 16) - phase_frac;
+    int64_t n = (since + period / 2) / period;
+    if (n < 1) {
+      n = 1;
+    } else if (n > TEMPO_PLL_GAP) {
+      Restart(t, period);
+      return;
+    }
+    int64_t err = since - n * period;
+    int64_t err_abs = err < 0 ? -err : err;
+
+    if (err_abs > period / 4) {
+      good = 0;
+      outliers++;
+      if (outliers >= TEMPO_PLL_OUTLIERS) {
+        Restart(t, (int64_t)interval << 16);
+      }
+      return;
+    }
+    outliers = 0;
+    if (err_abs <= (period >> TEMPO_PLL_LOCK_SHIFT)) {
+      if (good < TEMPO_PLL_LOCK_EDGES) {
+        good++;
+      }
+    } else if (!Locked()) {
+      good = 0;
+    }
+    error = (int32_t)(err / 65536);
+
+    // the error of n periods is spread over n periods
+    int64_t advance =
+        n * period + (err >> kp_shift) + phase_frac;
+    phase += (uint32_t)(advance >> 16);
+    phase_frac = advance & 0xFFFF;
+    period += (err / n) >> ki_shift;
+  }
+
+  // Coast counts an edge that came in without a time of its own at the
+  // predicted tick, the next Update measures against that
+  void Coast() {
+    if (edges == 0) {
+      return;
+    }
+    coasted++;
+    if (period == 0) {
+      return;
+    }
+    int64_t advance = period + phase_frac;
+    phase += (uint32_t)(advance >> 16);
+    phase_frac = advance & 0xFFFF;
+  }
+
+  // Period in ticks per edge, 16.16, 0 until two edges came in
+  uint64_t Period() { return period; }
+
+  // Phase is the tick of the last edge as the loop estimates it
+  uint32_t Phase() { return phase; }
+
+  // Error of the last edge against its prediction, in ticks
+  int32_t Error() { return error; }
+
+  bool Locked() { return good >= TEMPO_PLL_LOCK_EDGES; }
+};
+
+#endif
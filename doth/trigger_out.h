@@ -1,37 +1,90 @@
-class TriggerOut {
-  uint8_t gpio;
-  uint16_t trig_out_count;
-  uint16_t trig_out_max;
-  bool high;
-
- public:
-  void Init(uint8_t gpio_, uint16_t milliseconds, uint16_t loop_hz) {
-    gpio = gpio_;
-    trig_out_count = 0;
-    trig_out_max = loop_hz * milliseconds;
-    high = false;
-
-    gpio_init(gpio);
-    gpio_set_dir(gpio, GPIO_OUT);
-    gpio_pull_down(gpio);
-  }
-
-  void Update() {
-    if (trig_out_count > 0) {
-      trig_out_count--;
-      if (trig_out_count == 0) {
-        gpio_put(gpio, 0);
-        high = false;
-      } else if (!high) {
-        gpio_put(gpio, 1);
-        high = true;
-      }
-    }
-  }
-
-  void Trigger() {
-    trig_out_count = trig_out_max;
-    gpio_put(gpio, 1);
-    high = true;
-  }
-};
+// TriggerOut - pulses of exact width on a GPIO, timed by a PIO state machine
+//
+// Trigger() only puts the width into the state machine's FIFO, so it is
+// safe to call from the audio interrupt: the edge comes out on the sample
+// it was called on and the pulse ends on its own, to the microsecond,
+// whatever the main loop is doing. Pulses asked for while one is still
+// high follow right after it, up to 8 queued; more are dropped.
+//
+// TriggerAt() holds a pulse back until a given audio sample, for audio that
+// is rendered ahead of the output (queued for a flash write): Pump() fires
+// it once the sample count gets there.
+//
+// All TriggerOuts on one PIO share the program and use a state machine
+// each.
+
+#ifndef TRIGGER_OUT_H
+#define TRIGGER_OUT_H
+
+#include <stdint.h>
+
+#include "hardware/clocks.h"
+#include "hardware/pio.h"
+#include "pulse_out.pio.h"
+
+#define TRIGGER_OUT_LATER_BITS 3
+#define TRIGGER_OUT_LATER (1 << TRIGGER_OUT_LATER_BITS)
+
+class TriggerOut {
+  PIO pio;
+  uint sm;
+  uint32_t width;  // PIO cycles past the two every pulse takes
+  uint32_t dropped;
+  uint32_t later[TRIGGER_OUT_LATER];  // samples pulses are held back to
+  uint8_t later_head;
+  uint8_t later_tail;
+
+  static inline int offset_by_pio[2] = {-1, -1};
+
+ public:
+  void Init(PIO pio_, uint8_t gpio, uint32_t width_us) {
+    pio = pio_;
+    width = width_us > 2 ? width_us - 2 : 0;
+    dropped = 0;
+    later_head = 0;
+    later_tail = 0;
+    int &offset = offset_by_pio[pio_get_index(pio)];
+    if (offset < 0) {
+      offset = pio_add_program(pio, &pulse_out_program);
+    }
+    sm = pio_claim_unused_sm(pio, true);
+    pulse_out_program_init(pio, sm, offset, gpio);
+  }
+
+  void __not_in_flash_func(Trigger)() {
+    if (pio_sm_is_tx_fifo_full(pio, sm)) {
+      dropped++;
+      return;
+    }
+    pio_sm_put(pio, sm, width);
+  }
+
+  // TriggerAt pulses on sample, right away if now has got there
+  void __not_in_flash_func(TriggerAt)(uint32_t sample, uint32_t now) {
+    if ((int32_t)(sample - now) <= 0) {
+      Trigger();
+      return;
+    }
+    uint8_t next = (later_head + 1) & (TRIGGER_OUT_LATER - 1);
+    if (next == later_tail) {
+      dropped++;
+      return;
+    }
+    later[later_head] = sample;
+    later_head = next;
+  }
+
+  // Pump fires the pulses held back to now or before
+  void __not_in_flash_func(Pump)(uint32_t now) {
+    while (later_tail != later_head &&
+           (int32_t)(later[later_tail] - now) <= 0) {
+      Trigger();
+      later_tail = (later_tail + 1) & (TRIGGER_OUT_LATER - 1);
+    }
+  }
+
+  // Dropped counts pulses lost to a full FIFO or a full TriggerAt queue
+  uint32_t Dropped() { return dropped; }
+};
+
+#endif
@@ -0,0 +1,82 @@
+// UsbMidiIn - clock, transport and notes from the USB MIDI interface
+//
+// Task() reads every USB-MIDI event packet TinyUSB has queued since the last
+// call and hands them to the same callbacks the one-wire input uses. Call it
+// right after tud_task() with the time taken just before it: packets only
+// reach the FIFO inside tud_task(), so that is the closest timestamp there
+// is to when they arrived. Only the first clock of a batch gets it, the
+// others are passed a time of 0: they arrived earlier than that by some
+// unknown amount, and the tempo loop counts them at its prediction instead.
+//
+//   uint64_t t = time_us_64();
+//   tud_task();
+//   usb_midi_in.Task(t);
+
+#ifndef USB_MIDI_IN_H
+#define USB_MIDI_IN_H
+
+#include <stdint.h>
+
+#include "tusb.h"
+
+// code index numbers, the low nibble of the packet header
+#define USB_MIDI_CIN_NOTE_OFF 0x8
+#define USB_MIDI_CIN_NOTE_ON 0x9
+#define USB_MIDI_CIN_SINGLE_BYTE 0xF
+
+class UsbMidiIn {
+  void (*note_on)(uint8_t, uint8_t);
+  void (*note_off)(uint8_t);
+  void (*start)();
+  void (*cont)();
+  void (*stop)();
+  void (*timing)(uint64_t);
+  uint32_t packets;
+
+ public:
+  void Init(void (*note_on_)(uint8_t, uint8_t), void (*note_off_)(uint8_t),
+            void (*start_)(), void (*cont_)(), void (*stop_)(),
+            void (*timing_)(uint64_t)) {
+    note_on = note_on_;
+    note_off = note_off_;
+    start = start_;
+    cont = cont_;
+    stop = stop_;
+    timing = timing_;
+    packets = 0;
+  }
+
+  // Task handles all received packets, time_us is when they arrived
+  void Task(uint64_t time_us) {
+    uint8_t packet[4];
+    uint64_t clock_us = time_us;
+    while (tud_midi_n_packet_read(0, packet)) {
+      packets++;
+      uint8_t cin = packet[0] & 0x0F;
+      uint8_t status = packet[1];
+      if (cin == USB_MIDI_CIN_SINGLE_BYTE) {
+        if (status == 0xF8) {
+          timing(clock_us);
+          clock_us = 0;
+        } else if (status == 0xFA) {
+          start();
+        } else if (status == 0xFB) {
+          cont();
+        } else if (status == 0xFC) {
+          stop();
+        }
+      } else if (cin == USB_MIDI_CIN_NOTE_ON && packet[3] > 0) {
+        note_on(packet[2], packet[3]);
+      } else if (cin == USB_MIDI_CIN_NOTE_ON ||
+                 cin == USB_MIDI_CIN_NOTE_OFF) {
+        // note on with velocity 0 is a note off
+        note_off(packet[2]);
+      }
+    }
+  }
+
+  // Packets counts every packet received
+  uint32_t Packets() { return packets; }
+};
+
+#endif
@@ -0,0 +1,300 @@
+// Host fuzz harness for the playback state machine.
+//
+// main.cpp is compiled against the stand-ins in fuzz/host and the audio
+// interrupt handler is driven with parameter and event streams decoded from
+// the fuzzer input. The engine invariants are checked after every sample, so
+// an out-of-bounds sample read fails here instead of glitching (or faulting)
+// inside the ISR on hardware.
+//
+// libFuzzer:  make fuzz
+// AFL / replay: build with -DFUZZ_STANDALONE and pass input files (or stdin)
+
+#define main pikocore_main
+#include "../main.cpp"
+#undef main
+
+// the multiplexer scanners are not wired into main.cpp, they are built and
+// driven here so they keep compiling and their ring and queue logic is
+// exercised
+#include "../doth/multiplexer_button.h"
+#include "../doth/multiplexer_knob.h"
+
+// samples written by the engine
+static uint32_t fuzz_samples_written = 0;
+// settings page the param_set_* helpers write into
+static uint8_t fuzz_save_data[FLASH_PAGE_SIZE];
+// end of the firmware image, from the linker script on hardware
+char __flash_binary_end;
+
+static MultiplexerKnob fuzz_knobs;
+static MultiplexerButton fuzz_buttons;
+static struct repeating_timer *fuzz_knob_timer;
+static uint fuzz_knob_dma;
+
+void I2SAudio::Init(uint32_t sample_rate_, PIO pio_instance, uint state_machine,
+                    uint data_pin_, uint bck_pin_, uint lck_pin_) {
+  pio = pio_instance;
+  sm = state_machine;
+  sample_rate = sample_rate_;
+  initialized = true;
+}
+void I2SAudio::WriteSample(uint8_t sample_8bit) { fuzz_samples_written++; }
+void I2SAudio::WriteSilence() { fuzz_samples_written++; }
+void I2SAudio::Start() {}
+void I2SAudio::Stop() {}
+void I2SAudio::Pump() {}
+void I2SAudio::Hold(uint16_t lead) {}
+bool I2SAudio::Held() { return true; }
+void I2SAudio::Bridge() {}
+bool I2SAudio::Bridging() { return false; }
+
+#define FUZZ_MAX_SAMPLES (1 << 18)
+
+#define FUZZ_CHECK(cond)                                                      \
+  do {                                                                        \
+    if (!(cond)) {                                                            \
+      fprintf(stderr, "invariant failed: %s (sample=%d beat=%d/%d "           \
+                      "phase=%u,%u head=%d xfade=%u len=%u)\n",               \
+              #cond, engine.sample, engine.select_beat, engine.sample_beats,  \
+              engine.phase_sample[0], engine.phase_sample[1],                 \
+              engine.phase_head, engine.phase_xfade, raw_len(engine.sample)); \
+      __builtin_trap();                                                       \
+    }                                                                         \
+  } while (0)
+
+struct FuzzInput {
+  const uint8_t *data;
+  size_t size;
+  size_t pos;
+
+  bool More() { return pos < size; }
+  uint8_t Byte() { return pos < size ? data[pos++] : 0; }
+  uint16_t Knob() { return ((Byte() << 8) | Byte()) & 4095; }
+};
+
+static void fuzz_reset_engine() {
+  // every input starts from the engine state main() boots with
+  engine = AudioEngine();
+  engine.noise_gate_thresh = SAMPLES_PER_BEAT * 4;
+  engine.noise_gate_thresh_use = engine.noise_gate_thresh;
+  syncing_clicks = 0;
+  midi_button1 = -1;
+  midi_button2 = -1;
+  x1_f = x2_f = y1_f = y2_f = 0;
+  sequencer.Init();
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    input_button[i].Set(false);
+  }
+  param_set_bpm(BPM_SAMPLED, engine.bpm_set, engine.audio_clk_thresh);
+  engine.sample_beats = raw_beats(engine.sample);
+}
+
+static void fuzz_check_engine() {
+  FUZZ_CHECK(engine.sample < raw_count());
+  FUZZ_CHECK(engine.sample_beats == raw_beats(engine.sample));
+  FUZZ_CHECK(engine.select_beat < engine.sample_beats);
+  FUZZ_CHECK(engine.phase_sample[engine.phase_head] < raw_len(engine.sample));
+  FUZZ_CHECK(engine.phase_xfade == 0 ||
+             engine.phase_sample[1 - engine.phase_head] <
+                 raw_len(engine.sample));
+  FUZZ_CHECK(engine.phase_xfade <= (1 << HEAD_SHIFT));
+  FUZZ_CHECK(engine.retrig_sel < NUM_RETRIGS);
+  FUZZ_CHECK(engine.button_on <= NUM_BUTTONS &&
+             engine.button_on2 <= NUM_BUTTONS);
+  FUZZ_CHECK(engine.noise_gate_fade <= 8 && engine.retrig_volume_reduce <= 8);
+}
+
+static void fuzz_run(uint32_t n, uint32_t &budget) {
+  if (n > budget) {
+    n = budget;
+  }
+  budget -= n;
+  for (uint32_t i = 0; i < n; i++) {
+    host_time_us = (uint64_t)fuzz_samples_written * 1000000 / SAMPLE_RATE;
+    audio_interrupt_handler();
+    fuzz_check_engine();
+  }
+}
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv) {
+  // the engine prints debug lines once per second of audio
+  freopen("/dev/null", "w", stdout);
+  if (!sample_bank.Load(raw_audio, PICO_FLASH_SIZE_BYTES)) {
+    fprintf(stderr, "doth/audio2h.bin is not a valid sample bank\n");
+    abort();
+  }
+  i2s_audio.Init(SAMPLE_RATE, pio1, 0, I2S_DATA_PIN, I2S_BCK_PIN, I2S_LCK_PIN);
+  midiout = MidiOut_malloc(0, true);
+  pulse_outputs_init();
+  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
+    input_button[i].Init(i + 4, 5);
+  }
+  fuzz_knob_dma = host_dma_claimed;
+  fuzz_knobs.Init(200);
+  fuzz_knob_timer = host_repeating_timer;
+  fuzz_buttons.Init(pio0);
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  FuzzInput in = {data, size, 0};
+  randint_seed((in.Byte() << 8) | in.Byte());
+  fuzz_reset_engine();
+
+  uint32_t budget = FUZZ_MAX_SAMPLES;
+  while (in.More() && budget > 0) {
+    uint8_t op = in.Byte();
+    switch (op % 24) {
+      case 0:
+        fuzz_run(1 + in.Byte() * 64, budget);
+        break;
+      case 1:
+        engine.probability_jump = in.Byte();
+        break;
+      case 2:
+        engine.probability_direction = in.Byte();
+        break;
+      case 3:
+        engine.probability_retrig = in.Byte();
+        break;
+      case 4:
+        engine.probability_gate = in.Byte();
+        break;
+      case 5:
+        engine.probability_tunnel = in.Byte();
+        break;
+      case 6:
+        engine.sample_change = in.Knob() * raw_count() / 4095;
+        break;
+      case 7:
+        param_set_bpm(in.Knob() / 10, engine.bpm_set, engine.audio_clk_thresh);
+        break;
+      case 8:
+        param_set_break(in.Knob(), engine.filter_fc, engine.distortion,
+                        engine.probability_jump, engine.probability_retrig,
+                        engine.probability_gate, engine.probability_direction,
+                        engine.probability_tunnel, fuzz_save_data);
+        break;
+      case 9:
+        param_set_volume(in.Knob(), engine.distortion, engine.volume_reduce);
+        break;
+      case 10:
+        engine.filter_fc = in.Knob() * (LPF_MAX + 10) / 4095;
+        engine.filter_q = in.Byte();
+        break;
+      case 11: {
+        uint16_t v = in.Knob();
+        engine.stretch_change =
+            v < 100 ? 0 : v * engine.audio_clk_thresh * 2 / 4095;
+      } break;
+      case 12: {
+        uint8_t b = in.Byte();
+        input_button[b % NUM_BUTTONS].Set(b >= 128);
+      } break;
+      case 13:
+        engine.soft_sync = true;
+        break;
+      case 14:
+        engine.btn_reset = true;
+        break;
+      case 15:
+        if (in.Byte() & 1) {
+          do_start_everything();
+        } else {
+          do_stop_everything();
+        }
+        break;
+      case 16:
+        engine.flag_half_time = !engine.flag_half_time;
+        break;
+      case 17: {
+        uint16_t v = in.Knob();
+        engine.noise_gate_thresh = v > 3700 ? SAMPLES_PER_BEAT * 4
+                                     : SAMPLES_PER_BEAT * (v * 1000 / 4095) /
+                                           1000;
+      } break;
+      case 18:
+        engine.base_direction = !engine.base_direction;
+        break;
+      case 19: {
+        uint8_t b = in.Byte();
+        if (b < 64) {
+          sequencer.SetRecording(b & 1);
+        } else if (b < 128) {
+          sequencer.SetPlaying(b & 1);
+        } else if (b < 192) {
+          sequencer.Record(engine.select_beat);
+        } else if (b < 224) {
+          sequencer.Reset();
+        } else if (sequencer.IsPlaying()) {
+          sequencer.Next(engine.beat_num_total);
+          sequencer.NextI(engine.beat_num_total);
+        }
+      } break;
+      case 20:
+        engine.do_lock_clock = !engine.do_lock_clock;
+        break;
+      case 21:
+        engine.is_syncing = in.Byte() & 1;
+        engine.do_sync_play = in.Byte() & 1;
+        break;
+      case 22: {
+        // knob scanner: conversions land in the DMA ring, then one step. A
+        // step more than 64 conversions late (STEP_MAX_SAMPLES) may find the
+        // ring overwritten and has to leave the knob alone
+        uint8_t ch = fuzz_knobs.ScanChannel();
+        fuzz_knobs.Read(ch);
+        uint16_t before = fuzz_knobs.Value(ch);
+        uint32_t n = in.Byte() * 2;
+        uint16_t v = (in.Byte() << 8) | in.Byte();
+        for (uint32_t i = 0; i < n; i++) {
+          host_dma_write16(fuzz_knob_dma, v);
+        }
+        fuzz_knob_timer->callback(fuzz_knob_timer);
+        fuzz_knobs.Read(ch);
+        FUZZ_CHECK(fuzz_knobs.Value(ch) <= 4095);
+        if (n > 64) {
+          FUZZ_CHECK(fuzz_knobs.Value(ch) == before);
+        }
+      } break;
+      case 23: {
+        // button scanner: one scan pushed by the PIO, then the main loop
+        // takes the events
+        host_pio_rx = (in.Byte() << 8) | in.Byte();
+        host_pio_rx_full = true;
+        host_irq_handler[pio_get_irq_num(pio0, 1)]();
+        ButtonEvent e;
+        while (fuzz_buttons.Next(e)) {
+          FUZZ_CHECK(e.button < fuzz_knobs.NumChannels());
+          FUZZ_CHECK((int32_t)(time_us_32() - e.time_us) >= 0);
+        }
+      } break;
+    }
+  }
+  return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static int fuzz_file(FILE *f) {
+  static uint8_t buf[1 << 16];
+  size_t n = fread(buf, 1, sizeof(buf), f);
+  return LLVMFuzzerTestOneInput(buf, n);
+}
+
+int main(int argc, char **argv) {
+  LLVMFuzzerInitialize(&argc, &argv);
+  if (argc < 2) {
+    return fuzz_file(stdin);
+  }
+  for (int i = 1; i < argc; i++) {
+    FILE *f = fopen(argv[i], "rb");
+    if (f == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    fuzz_file(f);
+    fclose(f);
+  }
+  return 0;
+}
+#endif
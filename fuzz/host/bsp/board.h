@@ -0,0 +1 @@
+#include "pico_host.h"
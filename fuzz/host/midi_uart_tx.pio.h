@@ -0,0 +1,7 @@
+// Host stand-in for the pioasm output of doth/midi_uart_tx.pio.
+#include "pico_host.h"
+
+static const pio_program_t midi_uart_tx_program = {NULL, 0, -1};
+
+static inline void midi_uart_tx_program_init(PIO pio, uint sm, uint offset,
+                                             uint pin, uint baud) {}
@@ -0,0 +1,7 @@
+// Host stand-in for the pioasm output of doth/multiplexer_button.pio.
+#include "pico_host.h"
+
+static const pio_program_t mux_button_program = {NULL, 0, -1};
+
+static inline void mux_button_program_init(PIO pio, uint sm, uint offset,
+                                           uint select_pin, uint com_pin) {}
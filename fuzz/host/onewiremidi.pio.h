@@ -0,0 +1,8 @@
+// Host stand-in for the pioasm output of doth/onewiremidi.pio.
+#include "pico_host.h"
+
+static const pio_program_t midi_rx_program = {NULL, 0, -1};
+
+static inline pio_sm_config midi_rx_program_get_default_config(uint offset) {
+  return pio_get_default_sm_config();
+}
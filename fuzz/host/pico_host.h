@@ -0,0 +1,326 @@
+// Host-side stand-ins for the parts of the pico-sdk and TinyUSB that main.cpp
+// touches. Only used by the fuzz harness: hardware access is a no-op and time
+// is a virtual microsecond counter advanced by the harness.
+
+#ifndef PICO_HOST_H
+#define PICO_HOST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned int uint;
+
+#define __in_flash(group)
+#define __not_in_flash(group)
+#define __not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+#define __scratch_x(group)
+#define __scratch_y(group)
+
+// time
+typedef uint64_t absolute_time_t;
+static uint64_t host_time_us = 0;
+
+static inline uint32_t time_us_32() { return (uint32_t)host_time_us; }
+static inline uint64_t time_us_64() { return host_time_us; }
+static inline absolute_time_t get_absolute_time() { return host_time_us; }
+static inline uint32_t to_ms_since_boot(absolute_time_t t) {
+  return (uint32_t)(t / 1000);
+}
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+static inline void sleep_us(uint64_t us) { host_time_us += us; }
+static inline void sleep_ms(uint32_t ms) { host_time_us += 1000 * ms; }
+
+struct repeating_timer;
+typedef bool (*repeating_timer_callback_t)(struct repeating_timer *rt);
+struct repeating_timer {
+  int64_t delay_us;
+  repeating_timer_callback_t callback;
+  void *user_data;
+};
+// the last timer added, the harness fires it by hand
+static struct repeating_timer *host_repeating_timer = NULL;
+static inline bool add_repeating_timer_us(int64_t delay_us,
+                                          repeating_timer_callback_t callback,
+                                          void *user_data,
+                                          struct repeating_timer *out) {
+  out->delay_us = delay_us;
+  out->callback = callback;
+  out->user_data = user_data;
+  host_repeating_timer = out;
+  return true;
+}
+static inline bool cancel_repeating_timer(struct repeating_timer *timer) {
+  return true;
+}
+
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+static inline int hardware_alarm_claim_unused(bool required) { return 0; }
+static inline void hardware_alarm_set_callback(
+    uint alarm_num, hardware_alarm_callback_t callback) {}
+static inline bool hardware_alarm_set_target(uint alarm_num,
+                                             absolute_time_t t) {
+  return true;
+}
+
+// stdio
+static inline bool stdio_init_all() { return true; }
+
+// gpio
+#define GPIO_IN false
+#define GPIO_OUT true
+enum gpio_function { GPIO_FUNC_PWM = 4, GPIO_FUNC_PIO0 = 6, GPIO_FUNC_PIO1 = 7 };
+static bool host_gpio[30];
+static inline void gpio_init(uint gpio) { host_gpio[gpio] = false; }
+static inline void gpio_set_dir(uint gpio, bool out) {}
+static inline void gpio_pull_up(uint gpio) { host_gpio[gpio] = true; }
+static inline void gpio_pull_down(uint gpio) { host_gpio[gpio] = false; }
+static inline void gpio_put(uint gpio, bool value) { host_gpio[gpio] = value; }
+static inline bool gpio_get(uint gpio) { return host_gpio[gpio]; }
+static inline void gpio_put_masked(uint32_t mask, uint32_t value) {
+  for (uint i = 0; i < 30; i++) {
+    if (mask & (1u << i)) {
+      host_gpio[i] = (value >> i) & 1;
+    }
+  }
+}
+static inline uint32_t gpio_get_all() {
+  uint32_t all = 0;
+  for (uint i = 0; i < 30; i++) {
+    all |= (uint32_t)host_gpio[i] << i;
+  }
+  return all;
+}
+static inline void gpio_set_function(uint gpio, enum gpio_function fn) {}
+enum gpio_irq_level { GPIO_IRQ_EDGE_FALL = 0x4u, GPIO_IRQ_EDGE_RISE = 0x8u };
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+static inline void gpio_set_irq_enabled_with_callback(
+    uint gpio, uint32_t event_mask, bool enabled,
+    gpio_irq_callback_t callback) {}
+
+// adc
+static uint16_t host_adc[5];
+static uint host_adc_input = 0;
+static inline void adc_init() {}
+static inline void adc_gpio_init(uint gpio) {}
+static inline void adc_select_input(uint input) { host_adc_input = input; }
+static inline uint16_t adc_read() { return host_adc[host_adc_input % 5]; }
+static inline void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh,
+                                  bool err_in_fifo, bool byte_shift) {}
+static inline void adc_set_clkdiv(float clkdiv) {}
+static inline void adc_run(bool run) {}
+typedef struct {
+  uint32_t fifo;
+} adc_hw_t;
+static adc_hw_t host_adc_hw;
+#define adc_hw (&host_adc_hw)
+#define DREQ_ADC 36
+
+// clocks
+enum clock_index { clk_sys = 5 };
+static inline uint32_t clock_get_hz(enum clock_index clk_index) {
+  return 125000000;
+}
+
+// irq / sync
+typedef void (*irq_handler_t)(void);
+static inline void irq_set_exclusive_handler(uint num, irq_handler_t handler) {}
+static inline void irq_set_enabled(uint num, bool enabled) {}
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+#define PICO_SHARED_IRQ_HANDLER_HIGHEST_ORDER_PRIORITY 0xff
+// the last shared handler added per irq, the harness calls them by hand
+static irq_handler_t host_irq_handler[32];
+static inline void irq_add_shared_handler(uint num, irq_handler_t handler,
+                                          uint8_t order_priority) {
+  host_irq_handler[num] = handler;
+}
+#define IO_IRQ_BANK0 13
+#define PICO_HIGHEST_IRQ_PRIORITY 0x00
+static inline void irq_set_priority(uint num, uint8_t hardware_priority) {}
+static inline uint32_t save_and_disable_interrupts() { return 0; }
+static inline void restore_interrupts(uint32_t status) {}
+static inline void __wfi() {}
+static inline void __dmb() { __sync_synchronize(); }
+
+// flash
+#define XIP_BASE 0x10000000
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#endif
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+static inline void flash_range_erase(uint32_t flash_offs, size_t count) {}
+static inline void flash_range_program(uint32_t flash_offs, const uint8_t *data,
+                                       size_t count) {}
+
+// pio
+typedef struct pio_hw {
+  uint32_t fdebug;
+  uint32_t txf[4];
+} pio_hw_t;
+#define PIO_FDEBUG_RXSTALL_LSB 0
+typedef pio_hw_t *PIO;
+static pio_hw_t host_pio[2];
+#define pio0 (&host_pio[0])
+#define pio1 (&host_pio[1])
+typedef struct pio_program {
+  const uint16_t *instructions;
+  uint8_t length;
+  int8_t origin;
+} pio_program_t;
+typedef struct {
+  uint32_t clkdiv;
+} pio_sm_config;
+static inline pio_sm_config pio_get_default_sm_config() {
+  pio_sm_config c = {0};
+  return c;
+}
+static inline uint pio_add_program(PIO pio, const pio_program_t *program) {
+  return 0;
+}
+static inline void pio_gpio_init(PIO pio, uint pin) {}
+static inline void pio_sm_init(PIO pio, uint sm, uint initial_pc,
+                               const pio_sm_config *config) {}
+static inline void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {}
+static inline void pio_sm_set_clkdiv(PIO pio, uint sm, float div) {}
+static inline void pio_sm_set_consecutive_pindirs(PIO pio, uint sm,
+                                                  uint pin_base, uint pin_count,
+                                                  bool is_out) {}
+static inline void sm_config_set_in_pins(pio_sm_config *c, uint in_base) {}
+static inline void sm_config_set_set_pins(pio_sm_config *c, uint set_base,
+                                          uint set_count) {}
+enum pio_fifo_join { PIO_FIFO_JOIN_NONE, PIO_FIFO_JOIN_TX, PIO_FIFO_JOIN_RX };
+static inline void sm_config_set_fifo_join(pio_sm_config *c,
+                                           enum pio_fifo_join join) {}
+static inline void sm_config_set_in_shift(pio_sm_config *c, bool shift_right,
+                                          bool autopush, uint push_threshold) {}
+// one word the harness can put in front of any state machine's rx fifo
+static uint32_t host_pio_rx;
+static bool host_pio_rx_full = false;
+static inline bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+  return !host_pio_rx_full;
+}
+static inline bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) { return false; }
+static inline uint pio_sm_get_tx_fifo_level(PIO pio, uint sm) { return 0; }
+static inline uint32_t pio_sm_get(PIO pio, uint sm) {
+  host_pio_rx_full = false;
+  return host_pio_rx;
+}
+static inline void pio_sm_put(PIO pio, uint sm, uint32_t data) {}
+static inline uint pio_claim_unused_sm(PIO pio, bool required) { return 1; }
+static inline void pio_sm_claim(PIO pio, uint sm) {}
+static inline uint pio_get_index(PIO pio) { return pio == pio1; }
+static inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx) { return 0; }
+typedef enum pio_interrupt_source {
+  pis_interrupt0 = 8,
+  pis_sm0_rx_fifo_not_empty = 0,
+} pio_interrupt_source_t;
+static inline uint pio_get_irq_num(PIO pio, uint irqn) {
+  return 7 + 2 * (pio == pio1) + irqn;
+}
+static inline void pio_set_irqn_source_enabled(PIO pio, uint irq_index,
+                                               pio_interrupt_source_t source,
+                                               bool enabled) {}
+static inline pio_interrupt_source_t pio_get_rx_fifo_not_empty_interrupt_source(
+    uint sm) {
+  return (pio_interrupt_source_t)(pis_sm0_rx_fifo_not_empty + sm);
+}
+static inline bool pio_interrupt_get(PIO pio, uint pio_interrupt_num) {
+  return false;
+}
+static inline void pio_interrupt_clear(PIO pio, uint pio_interrupt_num) {}
+
+// dma
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+typedef struct {
+  uint32_t ctrl;
+} dma_channel_config;
+// the registers the knob scanner reads, host_dma_write16() moves them
+typedef struct {
+  uintptr_t read_addr;
+  uintptr_t write_addr;
+  uint32_t transfer_count;
+  uint32_t ring_bits;  // write ring, kept here instead of in ctrl
+} dma_channel_hw_t;
+static dma_channel_hw_t host_dma[12];
+static uint host_dma_claimed = 0;
+static inline int dma_claim_unused_channel(bool required) {
+  return host_dma_claimed++ % 12;
+}
+static inline dma_channel_hw_t *dma_channel_hw_addr(uint channel) {
+  return &host_dma[channel];
+}
+static inline dma_channel_config dma_channel_get_default_config(uint channel) {
+  dma_channel_config c = {0};
+  return c;
+}
+static inline void channel_config_set_transfer_data_size(
+    dma_channel_config *c, enum dma_channel_transfer_size size) {}
+static inline void channel_config_set_read_increment(dma_channel_config *c,
+                                                     bool incr) {}
+static inline void channel_config_set_write_increment(dma_channel_config *c,
+                                                      bool incr) {}
+static inline void channel_config_set_ring(dma_channel_config *c, bool write,
+                                           uint size_bits) {
+  c->ctrl = write ? size_bits : 0;
+}
+static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) {}
+static inline void dma_channel_configure(uint channel,
+                                         const dma_channel_config *config,
+                                         volatile void *write_addr,
+                                         const volatile void *read_addr,
+                                         uint transfer_count, bool trigger) {
+  host_dma[channel].read_addr = (uintptr_t)read_addr;
+  host_dma[channel].write_addr = (uintptr_t)write_addr;
+  host_dma[channel].transfer_count = transfer_count;
+  host_dma[channel].ring_bits = config->ctrl;
+}
+static inline void dma_channel_start(uint channel) {}
+static inline bool dma_channel_is_busy(uint channel) {
+  return host_dma[channel].transfer_count > 0;
+}
+static inline void dma_channel_set_trans_count(uint channel, uint32_t count,
+                                               bool trigger) {
+  host_dma[channel].transfer_count = count;
+}
+// host_dma_write16 is one 16-bit transfer into the channel's write ring
+static inline void host_dma_write16(uint channel, uint16_t value) {
+  dma_channel_hw_t *d = &host_dma[channel];
+  if (d->transfer_count == 0) {
+    return;
+  }
+  *(uint16_t *)d->write_addr = value;
+  uintptr_t mask = ~(uintptr_t)0;
+  if (d->ring_bits > 0) {
+    mask = ((uintptr_t)1 << d->ring_bits) - 1;
+  }
+  d->write_addr = (d->write_addr & ~mask) | ((d->write_addr + 2) & mask);
+  d->transfer_count--;
+}
+
+// tinyusb
+static inline bool tusb_init() { return true; }
+static inline void tud_task() {}
+static inline uint32_t tud_midi_n_stream_write(uint8_t itf, uint8_t cable_num,
+                                               uint8_t const *buffer,
+                                               uint32_t bufsize) {
+  return bufsize;
+}
+static inline bool tud_midi_mounted() { return true; }
+static inline bool tud_midi_n_packet_read(uint8_t itf, uint8_t packet[4]) {
+  return false;
+}
+static inline uint32_t tud_vendor_available() { return 0; }
+static inline uint32_t tud_vendor_read(void *buffer, uint32_t bufsize) {
+  return 0;
+}
+static inline uint32_t tud_vendor_write(void const *buffer, uint32_t bufsize) {
+  return bufsize;
+}
+static inline uint32_t tud_vendor_write_flush() { return 0; }
+
+#endif  // PICO_HOST_H
@@ -0,0 +1,7 @@
+// Host stand-in for the pioasm output of doth/pulse_out.pio.
+#include "pico_host.h"
+
+static const pio_program_t pulse_out_program = {NULL, 0, -1};
+
+static inline void pulse_out_program_init(PIO pio, uint sm, uint offset,
+                                          uint pin) {}
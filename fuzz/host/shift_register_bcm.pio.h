@@ -0,0 +1,11 @@
+// Host stand-in for the pioasm output of doth/shift_register_bcm.pio.
+#include "pico_host.h"
+
+#define shift_register_bcm_OVERHEAD 36
+
+static const pio_program_t shift_register_bcm_program = {NULL, 0, -1};
+
+static inline void shift_register_bcm_program_init(PIO pio, uint sm,
+                                                   uint offset, uint ser_pin,
+                                                   uint srclk_pin,
+                                                   float clkdiv) {}
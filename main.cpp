@@ -1,4 +1,5 @@
 // c++ include
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -38,6 +39,8 @@
 // pikocore files
 #include "doth/audio2h.h"
 #include "doth/button.h"
+#include "doth/clock_in.h"
+#include "doth/clock_out.h"
 #include "doth/delay.h"
 #include "doth/easing.h"
 #include "doth/filter.h"
@@ -45,11 +48,20 @@
 #include "doth/knob.h"
 #include "doth/led.h"
 #include "doth/ledarray.h"
+#include "doth/midi_clock_out.h"
 #include "doth/midi_out.h"
+#include "doth/midi_uart_out.h"
 #include "doth/onewiremidi.h"
-#include "doth/runningavg.h"
+#include "doth/sample_bank.h"
+#if SAMPLE_UPLOAD_ENABLED == 1
+#include "doth/sample_upload.h"
+#endif
+#include "doth/scheduler.h"
 #include "doth/sequencer.h"
+#include "doth/settings_store.h"
+#include "doth/tempo_pll.h"
 #include "doth/trigger_out.h"
+#include "doth/usb_midi_in.h"
 
 #if I2S_AUDIO_ENABLED == 1
 #include "doth/i2s_audio.h"
@@ -86,11 +98,26 @@
 // GPIO pins - updated for target_architecture.md
 #define CLOCK_IN_PIN 2   // clock in pin (was 22, now updated)
 #define RESET_IN_PIN 3   // reset in pin 
+#define CLOCK_IN_PPQN 2  // clock in pulses per beat (pocket operator sync)
 #define CLOCK_OUT_PIN 4  // clock out pin
 #define RESET_OUT_PIN 5  // reset out pin
+#define CLOCK_OUT_MULTIPLY 1  // clock out pulses per CLOCK_OUT_DIVIDE beats
+#define CLOCK_OUT_DIVIDE 1
+#define CLOCK_OUT_PULSE_US 5000
+#define TRIGGER_OUT_PULSE_US 10000
+#define MIDI_UART_OUT_PIN 12  // midi out, with MIDI_UART_OUT_ENABLED
 #define TRIGO_PIN 21     // trigger out pin (legacy, may conflict with keyboard mux)
-#define MAIN_LOOP_HZ 4
-#define MAIN_LOOP_DELAY 50
+
+// main loop tasks, see doth/scheduler.h
+enum {
+  TASK_USB,       // tud_task and sample upload
+  TASK_CLOCK_IN,  // clock in / midi in
+  TASK_TICK,      // ms counters, trigger out, flash save/load
+  TASK_BUTTONS,
+  TASK_KNOBS,
+  TASK_LEDS,
+  TASK_STATS,     // scheduler accounting, with DEBUG_SCHEDULER
+};
 
 #if WS2812_ENABLED == 1
 #include "doth/WS2812.hpp"
@@ -112,7 +139,6 @@
 #define SAVE_PROB_JUMP 10
 #define SAVE_PROB_GATE 11
 #define SAVE_PROB_TUNNEL 12
-#define FLASH_TARGET_OFFSET2 FLASH_TARGET_OFFSET * 2
 
 #define MIDI_NOTES_AVAILABLE_TOTAL 28
 uint8_t midi_notes_available[MIDI_NOTES_AVAILABLE_TOTAL] = {
@@ -120,8 +146,90 @@ uint8_t midi_notes_available[MIDI_NOTES_AVAILABLE_TOTAL] = {
     60, 62, 64, 65, 67, 69, 71, 72, 74, 76, 77, 79, 81, 83};
 uint8_t midi_notes_set[8] = {36, 38, 40, 41, 43, 45, 47, 48};
 
-const uint8_t *flash_target_contents =
-    (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET2);
+// the firmware image ends at __flash_binary_end, the settings and the sample
+// partition must lie past it
+extern char __flash_binary_end;
+uint32_t flash_image_end() {
+  return (uint32_t)(uintptr_t)&__flash_binary_end - XIP_BASE;
+}
+
+// settings are journaled in a ring of sectors from SETTINGS_OFFSET
+SettingsStore settings_store;
+static_assert(SETTINGS_SECTORS * FLASH_SECTOR_SIZE <= SETTINGS_REGION_SIZE,
+              "the settings journal fits its region");
+
+// __settings_offset marks the settings region in the ELF, so the build can
+// check that the firmware image ends below it
+#define FLASH_LAYOUT_STR(x) #x
+#define FLASH_LAYOUT_XSTR(x) FLASH_LAYOUT_STR(x)
+asm(".global __settings_offset\n"
+    ".set __settings_offset, " FLASH_LAYOUT_XSTR(SETTINGS_OFFSET));
+
+// samples come from the sample partition (a samples-only UF2 written by
+// audio2h --uf2) or, if that is empty, from the bank linked into the firmware
+SampleBank sample_bank;
+
+// the audio interrupt reads samples through these, they run from RAM like
+// the interrupt itself (see audio_interrupt_handler)
+uint8_t __not_in_flash_func(raw_val)(int s, int i) {
+  return sample_bank.Val(s, i);
+}
+unsigned int __not_in_flash_func(raw_len)(int s) { return sample_bank.Len(s); }
+unsigned int __not_in_flash_func(raw_beats)(int s) {
+  return sample_bank.Beats(s);
+}
+uint16_t __not_in_flash_func(raw_count)() { return sample_bank.Count(); }
+
+#if SAMPLE_UPLOAD_ENABLED == 1
+SampleUpload sample_upload;
+#endif
+
+// sample_partition_size is 0 when the firmware image runs into the partition
+uint32_t sample_partition_size() {
+  if (flash_image_end() > SAMPLE_BANK_OFFSET) {
+    return 0;
+  }
+  return SETTINGS_OFFSET - SAMPLE_BANK_OFFSET;
+}
+
+void sample_bank_print() {
+  printf("  %lu samples per beat\n", sample_bank.SamplesPerBeat());
+  for (uint16_t s = 0; s < raw_count(); s++) {
+    printf("  sample %d: %d beats, %lu samples\n", s, raw_beats(s),
+           raw_len(s));
+  }
+}
+
+// sample_bank_init returns true if the bank came from the partition
+bool sample_bank_init() {
+  sample_bank.Clear();
+  if (sample_partition_size() > 0 &&
+      sample_bank.Load((const uint8_t *)(XIP_BASE + SAMPLE_BANK_OFFSET),
+                       sample_partition_size())) {
+    printf("samples: %d from partition at %d\n", raw_count(),
+           SAMPLE_BANK_OFFSET);
+    sample_bank_print();
+    return true;
+  }
+#if SAMPLE_BANK_LINKED == 1
+  if (sample_bank.Load(raw_audio, PICO_FLASH_SIZE_BYTES)) {
+    printf("samples: %d linked into firmware\n", raw_count());
+    sample_bank_print();
+    return false;
+  }
+#endif
+  printf("samples: no sample bank found, flash one with audio2h --uf2\n");
+  return false;
+}
+
+// sample_uploading mutes playback while the partition is rewritten
+bool __not_in_flash_func(sample_uploading)() {
+#if SAMPLE_UPLOAD_ENABLED == 1
+  return sample_upload.Active();
+#else
+  return false;
+#endif
+}
 
 // inputs
 Button input_button[NUM_BUTTONS];
@@ -131,96 +239,149 @@ Knob input_knob[NUM_KNOBS];
 LEDArray ledarray;
 
 TriggerOut output_trigger;
+#if CLOCK_OUT_ENABLED == 1
+ClockOut clock_out;
+TriggerOut reset_out;
+#endif
+ClockIn clock_in;
+ClockIn reset_in;
 
 #if I2S_AUDIO_ENABLED == 1
 I2SAudio i2s_audio;
 #endif
 
-// audio tracking
-uint8_t audio_now = 0;
-uint8_t audio_clk = 0;
-uint8_t audio_clk_thresh = 48;
-bool do_mute = false;
-uint8_t do_mute_debounce = 0;
+// AudioEngine is everything the audio interrupt reads or writes, in one
+// struct in scratch X: a 4 KB bank of SRAM that only core 1 would otherwise
+// use, so the interrupt never waits on DMA or USB traffic in the striped
+// banks. The interrupt addresses every field from one base register. The hot
+// part, touched on every sample, comes first and is ordered bytes, halfwords,
+// words, so each field is in reach of the immediate offset of a Cortex-M0+
+// load or store (ldrb 0-31, ldrh 0-62, ldr 0-124). The cold part changes on
+// beats, retrigs or from the main loop.
+struct AudioEngine {
+  // hot: bytes
+  uint8_t audio_now = 0;
+  uint8_t audio_clk = 0;
+  uint8_t audio_clk_thresh = 48;
+  bool do_mute = false;
+  bool is_syncing = false;
+  bool do_sync_play = false;
+  bool beat_onset = false;
+  bool btn_reset = 0;
+  bool soft_sync = 0;
+  bool phase_head = 0;
+  bool direction[2] = {1, 1};  // 0 = reverse, 1 = forward
+  bool fx_retrig = false;
+  bool btn_retrig = 0;
+  uint8_t button_on = NUM_BUTTONS;
+  uint8_t button_on2 = 3;
+  uint8_t volume_mod = 0;
+  uint8_t distortion = 0;
+  uint8_t volume_reduce = 0;
+  uint8_t retrig_volume_reduce = 0;
+  uint8_t noise_gate_fade = 0;
+  uint8_t filter_fc = LPF_MAX + 10;
+  uint8_t filter_q = 0;
+  uint8_t retrig_filter = 0;
+  uint8_t retrig_filter_change = 0;
+  uint8_t button_filter = 0;
+  int8_t retrig_pitch_change = 0;
+  uint8_t stretch_change = 0;
+  uint8_t retrig_sel = 4;
+  bool flag_half_time = 0;  // specifies quarter note or not
+
+  // hot: halfwords
+  uint16_t sample = 0;
+  volatile uint16_t select_beat = 0;
+  uint16_t noise_gate_val = 0;
+  uint16_t noise_gate_thresh_use = 0;
+
+  // hot: words
+  // following an external clock: the audio interrupt counts every sample
+  // and notes the sample each beat started on, beat_nudge lengthens or
+  // shortens the current beat to pull it onto the clock
+  volatile uint32_t audio_sample_count = 0;
+  // samples rendered ahead of the output by a save's pre-roll, played down
+  // while DMA bridges the flash write (see audio_preroll)
+  volatile uint32_t audio_lead = 0;
+  uint32_t beat_counter = 0;  // beat = eighth-note
+  // length of the current beat, 0 until a bpm is set
+  uint32_t beat_thresh = 0;
+  volatile int32_t beat_nudge = 0;
+  uint32_t phase_sample[2] = {0, 0};
+  uint32_t phase_retrig = 0;
+  uint32_t phase_xfade = 0;
+
+  // cold: beat tracking
+  // beat length in samples as 32.32 fixed point, the fraction is carried
+  // from beat to beat so lengths alternate between floor and ceiling without
+  // drift
+  uint64_t beat_length = 0;
+  volatile uint64_t beat_length_next = 0;  // taken at the next beat
+  uint32_t beat_frac = 0;
+  volatile uint32_t beat_num_total = 0;
+  volatile uint32_t beat_sample = 0;
+  uint16_t bpm_set = 79;
+  uint16_t select_beat_freeze = 0;
+  volatile bool beat_length_pending = false;
+  volatile bool beat_downbeat = false;  // the next beat starts the count over
+  bool beat_led = 0;
+  bool audio_prerolling = false;  // ticks rendered ahead, see audio_preroll
+  bool do_lock_clock = false;
+  bool base_direction = 1;  // 0 = reverse, 1 == forward
+  uint8_t do_mute_debounce = 0;
+
+  // cold: sample tracking
+  uint16_t sample_beats = 8;
+  uint16_t sample_change = 0;
+  uint16_t sample_add = 0;
+  uint16_t sample_set = 0;
+
+  // cold: noise gate
+  uint16_t noise_gate_thresh = 0;
+
+  // cold: probabilities
+  uint8_t probability_jump = 0;
+  uint8_t probability_direction = 0;
+  uint8_t probability_retrig = 0;
+  uint8_t probability_gate = 0;
+  uint8_t probability_tunnel = 0;  // jumps between samples
+
+  // cold: retriggering / fx
+  uint8_t retrig_count = 0;
+  uint8_t retrig_max = 2;
+  uint8_t retrig_volume_reduce_change = 0;
+  bool retrig_pitch_up = false;
+  bool retrig_pitch_down = false;
+  bool button_filter_on = false;
+  uint8_t bitcrush = 0;
+};
+
+static_assert(offsetof(AudioEngine, flag_half_time) < 32,
+              "hot bytes are in reach of ldrb");
+static_assert(offsetof(AudioEngine, noise_gate_thresh_use) < 64,
+              "hot halfwords are in reach of ldrh");
+static_assert(offsetof(AudioEngine, phase_xfade) < 128,
+              "hot words are in reach of ldr");
+
+AudioEngine __scratch_x("audio") engine;
 
 // midi out
 MidiOut *midiout;
+#if MIDI_CLOCK_OUT_ENABLED == 1
+MidiClockOut midi_clock_out;
+#endif
+#if MIDI_UART_OUT_ENABLED == 1
+MidiUartOut midi_uart_out;
+void midi_uart_copy(const uint8_t *msg, uint8_t len) {
+  midi_uart_out.Write(msg, len);
+}
+#endif
 
-// sample tracking
-uint16_t sample = 0;
-uint16_t sample_beats = 8;
-uint16_t sample_change = 0;
-uint16_t sample_add = 0;
-uint16_t sample_set = 0;
-uint32_t phase_sample[] = {0, 0};
-uint32_t phase_retrig = 0;
-bool phase_head = 0;
-uint32_t phase_xfade = 0;
-
-// beat tracking
-volatile uint16_t select_beat = 0;
-uint16_t select_beat_freeze = 0;
-bool direction[] = {1, 1};  // 0 = reverse, 1 = forward
-bool base_direction = 1;    // 0 = reverse, 1 == forward
-uint8_t volume_mod = 0;
-
-// volume/distortion/filter/bitcrush
-uint8_t distortion = 0;
-uint8_t volume_reduce = 0;
-uint8_t filter_fc = LPF_MAX + 10;
 uint8_t hpf_fc = 0;
-uint8_t filter_q = 0;
-uint8_t bitcrush = 0;
-uint8_t stretch_change = 0;
-bool do_lock_clock = false;
-
-// beat tracking (beat = eighth-note)
-uint32_t beat_counter = 0;
-uint16_t bpm_set = 79;
-uint32_t beat_thresh = 21120000;
-volatile uint32_t beat_num_total = 0;
-bool beat_onset = false;
-bool beat_led = 0;
-bool btn_reset = 0;
-bool soft_sync = 0;
-bool is_syncing = false;
-bool do_sync_play = false;
-
-// probabilities
-uint8_t probability_jump = 0;
-uint8_t probability_direction = 0;
-uint8_t probability_retrig = 0;
-uint8_t probability_gate = 0;
-uint8_t probability_tunnel = 0;  // jumps between samples
-
-// retriggering / fx
-bool fx_retrig = false;
-bool btn_retrig = 0;
-uint8_t retrig_sel = 4;
-uint8_t retrig_count = 0;
-uint8_t retrig_max = 2;
-uint8_t retrig_filter = 0;
-uint8_t retrig_filter_change = 0;
-int8_t retrig_pitch_change = 0;
-uint8_t retrig_volume_reduce = 0;
-uint8_t button_on = NUM_BUTTONS;
-uint8_t button_on2 = 3;
-uint8_t button_filter = 0;
-bool button_filter_on = false;
-uint8_t retrig_volume_reduce_change = 0;
-bool retrig_pitch_up = false;
-bool retrig_pitch_down = false;
+TempoPLL clock_pll;
 uint8_t syncing_clicks = 0;
 
-// bpm configuring
-bool flag_half_time = 0;  // specifies quarter note or not
-
-// noise gate
-uint16_t noise_gate_val;
-uint16_t noise_gate_thresh;
-uint16_t noise_gate_thresh_use;
-uint8_t noise_gate_fade = 0;
-
 // buttons
 bool button_trigger[8] = {false, false, false, false,
                           false, false, false, false};
@@ -232,6 +393,9 @@ Sequencer sequencer;
 // midi handler
 Onewiremidi *onewiremidi;
 #endif
+#if USB_MIDI_IN_ENABLED == 1
+UsbMidiIn usb_midi_in;
+#endif
 int8_t midi_button1 = -1;
 int8_t midi_button2 = -1;
 
@@ -274,30 +438,127 @@ void param_set_break(uint16_t knob_val, uint8_t &filter_fc_,
       (uint8_t)(distortion_ * 1095 / DISTORTION_MAX + 3000);
 }
 
-void param_set_bpm(uint16_t bpm, uint16_t &bpm_set_, uint32_t &beat_thresh_,
+// beat_set_length sets the length of a beat (eighth note) in samples, 32.32
+// fixed point. The audio interrupt takes it at the next beat, so the beat
+// playing now keeps its length.
+void beat_set_length(uint64_t length) {
+  uint32_t irq = save_and_disable_interrupts();
+  if (engine.beat_thresh == 0) {
+    // nothing is playing yet
+    engine.beat_length = length;
+    engine.beat_frac = 0;
+    engine.beat_thresh = length >> 32;
+  } else {
+    engine.beat_length_next = length;
+    engine.beat_length_pending = true;
+  }
+  restore_interrupts(irq);
+}
+
+void param_set_bpm(uint16_t bpm, uint16_t &bpm_set_,
                    uint8_t &audio_clk_thresh_) {
-  if (bpm > 360) {
+  if (bpm == 0 || bpm > 360) {
     return;
   }
   // set default bpm
   bpm_set_ = bpm;
-  
-  // Calculate samples per beat (eighth note)
-  // BPM refers to quarter notes, so eighth notes are 2x faster
-  // Formula: (sample_rate * 60) / (bpm * 2) = samples per eighth note
-  double eighth_notes_per_second = ((double)bpm * 2.0) / 60.0;
-  beat_thresh_ = round((double)SAMPLE_RATE / eighth_notes_per_second);
-  
-  // For reference at 48kHz and 165 BPM:
-  // eighth_notes_per_second = 165*2/60 = 5.5
-  // beat_thresh = 48000 / 5.5 = 8,727 samples per eighth note
-  
+
+  // samples per eighth note: sample_rate * 60 / (bpm * 2), e.g. 8727.27 at
+  // 48kHz and 165 BPM
+  beat_set_length(((uint64_t)SAMPLE_RATE * 30 << 32) / bpm);
+
   // audio_clk_thresh controls sample playback speed
   // At 48kHz, we want to play 1 audio sample per interrupt, so thresh = 1
-  audio_clk_thresh_ = 1;  
-  
-  printf("BPM set to %d, beat_thresh=%d samples (%.2f ms per eighth note)\n", 
-         bpm_set_, beat_thresh_, (float)beat_thresh_ / SAMPLE_RATE * 1000.0);
+  audio_clk_thresh_ = 1;
+
+#ifdef DEBUG_CLOCK
+  printf("BPM set to %d\n", bpm_set_);
+#endif
+}
+
+// audio_sample_out is the sample the audio rendered now plays on, which is
+// audio_sample_count unless a save rendered ahead of the output. Outputs
+// that go with the audio (midi, pulses, the start of a beat) use it, so they
+// keep to the wall clock that audio_sample_count counts.
+uint32_t __not_in_flash_func(audio_sample_out)() {
+  return engine.audio_sample_count + engine.audio_lead;
+}
+
+// pulse_outputs_pump fires pulses held back for audio rendered ahead
+void __not_in_flash_func(pulse_outputs_pump)() {
+  output_trigger.Pump(engine.audio_sample_count);
+#if CLOCK_OUT_ENABLED == 1
+  clock_out.Pump(engine.audio_sample_count);
+  reset_out.Pump(engine.audio_sample_count);
+#endif
+}
+
+// sample_at returns the audio sample a time_us_64() timestamp fell on
+uint32_t sample_at(uint64_t time_us) {
+  uint32_t elapsed_us = time_us_64() - time_us;
+  return engine.audio_sample_count -
+         (uint64_t)elapsed_us * SAMPLE_RATE / 1000000;
+}
+
+// beat_follow sets the beat length from a clock PLL, the clock has ppqn
+// edges per quarter note. On edges that fall on a beat it also moves the
+// end of the beat playing now onto the sample the PLL puts the next clock
+// beat at, and on the downbeat starts the beat count over. Until the PLL
+// locks beats are restarted on those edges instead.
+void beat_follow(TempoPLL &pll, uint8_t ppqn, bool on_beat, bool downbeat) {
+  if (pll.Period() == 0) {
+    return;
+  }
+  uint64_t length = pll.Period() * ppqn / 2;  // eighth note, 16.16 samples
+  uint32_t thresh = (length + 0x8000) >> 16;
+  if (thresh < 2 || thresh > SAMPLE_RATE * 10) {
+    return;
+  }
+  beat_set_length(length << 16);
+  engine.bpm_set = (SAMPLE_RATE * 30 + thresh / 2) / thresh;
+  if (!on_beat) {
+    return;
+  }
+  if (!pll.Locked()) {
+    if (downbeat) {
+      engine.btn_reset = true;
+    } else {
+      engine.soft_sync = true;
+    }
+    return;
+  }
+
+  uint32_t irq = save_and_disable_interrupts();
+  // distance from the start of the beat playing to the clock beat, wrapped
+  // to the nearest beat: negative when the engine has not got there yet
+  int32_t d = (int32_t)(pll.Phase() - engine.beat_sample) % (int32_t)thresh;
+  if (d >= (int32_t)thresh / 2) {
+    d -= thresh;
+  } else if (d < -(int32_t)thresh / 2) {
+    d += thresh;
+  }
+  int32_t nudge = d + (int32_t)thresh - (int32_t)engine.beat_thresh;
+  int32_t nudge_max = thresh / 8;
+  if (nudge > nudge_max) {
+    nudge = nudge_max;
+  } else if (nudge < -nudge_max) {
+    nudge = -nudge_max;
+  }
+  engine.beat_nudge = nudge;
+  if (downbeat) {
+    if (d >= 0) {
+      // the downbeat is the beat playing
+      engine.beat_num_total = 0;
+      engine.beat_led = 1;
+    } else {
+      engine.beat_downbeat = true;
+    }
+  }
+  restore_interrupts(irq);
+#ifdef DEBUG_CLOCK
+  printf("pll %lu samples/beat, error %ld, beat %ld\n", thresh, pll.Error(),
+         d);
+#endif
 }
 
 void param_set_volume(uint16_t knobval, uint8_t &distortion_,
@@ -307,22 +568,33 @@ void param_set_volume(uint16_t knobval, uint8_t &distortion_,
     volume_reduce_ = (2000 - knobval) * (VOLUME_REDUCE_MAX + 3) / 2000;
   } else if (knobval > 3000) {
     volume_reduce_ = 0;
-    distortion = (knobval - 3000) * DISTORTION_MAX / (4095 - 3000);
+    engine.distortion = (knobval - 3000) * DISTORTION_MAX / (4095 - 3000);
   } else {
     volume_reduce_ = 0;
-    distortion = 0;
+    engine.distortion = 0;
   }
 }
 
-// randint returns value
-int randint(int min, int max) {
-  int MaxValue = max - min;
-  int random_value =
-      (int)((1.0 + MaxValue) * rand() /
-            (RAND_MAX + 1.0));  // Scale rand()'s return value against RAND_MAX
-                                // using doubles instead of a pure modulus to
-                                // have a more distributed result.
-  return (random_value + min);
+// beat_position returns where a beat starts inside a sample, from the slice
+// table so heads start on the transient, wrapped so that half-time positions
+// never read past the sample
+uint32_t __not_in_flash_func(beat_position)(uint16_t s, uint16_t beat) {
+  return sample_bank.Slice(s, (beat << engine.flag_half_time) % raw_beats(s));
+}
+
+// randint returns a value between min and max (inclusive) from a xorshift32
+// generator in RAM, rand() and the double maths it needed ran from flash
+uint32_t __scratch_x("audio") randint_state = 2463534242;
+
+void randint_seed(uint32_t seed) { randint_state = seed != 0 ? seed : 1; }
+
+int __not_in_flash_func(randint)(int min, int max) {
+  randint_state ^= randint_state << 13;
+  randint_state ^= randint_state >> 17;
+  randint_state ^= randint_state << 5;
+  // scaled by multiplying instead of a modulus to keep it evenly distributed
+  return min + (int)(((uint64_t)randint_state * (uint32_t)(max - min + 1)) >>
+                     32);
 }
 
 /*
@@ -333,7 +605,7 @@ int randint(int min, int max) {
 void audio_interrupt_handler();
 
 // Timer callback for I2S audio
-bool audio_timer_callback(struct repeating_timer *t) {
+bool __not_in_flash_func(audio_timer_callback)(struct repeating_timer *t) {
   // Blink LED every ~1 second to confirm timer is running
   static uint32_t callback_counter = 0;
   callback_counter++;
@@ -348,7 +620,7 @@ bool audio_timer_callback(struct repeating_timer *t) {
 #if I2S_TEST_SINE == 1
 // Sine wave test: Generate 440Hz sine wave using full 256-entry table
 // This gives smooth output with 256 amplitude levels
-const uint8_t sine_table[256] = {
+const uint8_t __not_in_flash("audio_tables") sine_table[256] = {
   128,131,134,137,140,143,146,149,152,155,158,162,165,167,170,173,
   176,179,182,185,188,190,193,196,198,201,203,206,208,211,213,215,
   218,220,222,224,226,228,230,232,234,235,237,238,240,241,243,244,
@@ -372,18 +644,32 @@ static uint16_t sine_phase = 0;
 #define SINE_PHASE_INC 601  // 440Hz at 48kHz with 256-entry table (8.8 fixed-point)
 #endif
 
-void audio_interrupt_handler()
+// the interrupt and everything it calls per sample run from RAM: a cache
+// miss on flash stalls for the whole XIP fetch, and the cache is shared with
+// the main loop and USB
+void __not_in_flash_func(audio_interrupt_handler)()
 #else
-void pwm_interrupt_handler()
+void __not_in_flash_func(pwm_interrupt_handler)()
 #endif
 {
   // CRITICAL FIX: Force disable button override of select_beat
   // Buttons are still being read but should not control playback
-  button_on = NUM_BUTTONS;
-  button_on2 = NUM_BUTTONS;
+  engine.button_on = NUM_BUTTONS;
+  engine.button_on2 = NUM_BUTTONS;
   
 #if I2S_AUDIO_ENABLED == 0
   pwm_clear_irq(pwm_gpio_to_slice_num(AUDIO_PIN));
+#else
+  // DMA plays audio queued ahead of a flash write, the engine waits for it
+  // while the wall clock and the pulses held back for that audio go on
+  if (i2s_audio.Bridging()) {
+    engine.audio_sample_count++;
+    if (engine.audio_lead > 0) {
+      engine.audio_lead--;
+    }
+    pulse_outputs_pump();
+    return;
+  }
 #endif
 
 #if I2S_TEST_SINE == 1
@@ -412,7 +698,25 @@ void pwm_interrupt_handler()
   return;  // Skip all normal audio processing
 #endif
 
-  if ((!do_sync_play && is_syncing) || do_mute) {
+#if I2S_AUDIO_ENABLED == 1
+  if (engine.audio_prerolling) {
+    engine.audio_lead++;
+  } else {
+    engine.audio_sample_count++;
+    if (!i2s_audio.Holding()) {
+      engine.audio_lead = 0;  // the queue has played out
+    }
+    pulse_outputs_pump();
+  }
+#else
+  engine.audio_sample_count++;
+#endif
+#if MIDI_CLOCK_OUT_ENABLED == 1
+  midi_clock_out.Transport(audio_sample_out());
+#endif
+
+  if ((!engine.do_sync_play && engine.is_syncing) || engine.do_mute ||
+      sample_uploading()) {
 #if I2S_AUDIO_ENABLED == 1
     i2s_audio.WriteSilence();
 #else
@@ -437,76 +741,99 @@ void pwm_interrupt_handler()
   }
 
   // clocking when to change beats
-  beat_counter++;
+  engine.beat_counter++;
   
+#ifdef DEBUG_PWM
   // Debug: Print once per second to confirm interrupt is running
   static uint32_t debug_counter = 0;
   if (++debug_counter >= SAMPLE_RATE) {
     debug_counter = 0;
     printf("[INT] beat_num=%lu, ctr=%lu/%lu, sb=%d, onset=%d, beat_det=%s\n", 
-           beat_num_total, beat_counter, beat_thresh, select_beat, beat_onset?1:0,
-           (beat_counter >= beat_thresh) ? "YES" : "no");
+           engine.beat_num_total, engine.beat_counter, engine.beat_thresh, engine.select_beat, engine.beat_onset?1:0,
+           (engine.beat_counter >= engine.beat_thresh) ? "YES" : "no");
   }
+#endif
   
-  if ((!is_syncing && beat_counter >= beat_thresh) || btn_reset || soft_sync) {
+  if ((!engine.is_syncing &&
+       (int32_t)engine.beat_counter >=
+           (int32_t)engine.beat_thresh + engine.beat_nudge) ||
+      engine.btn_reset || engine.soft_sync) {
 #ifdef DEBUG_CLOCK
-    if (soft_sync) {
-      printf("softsync; beat_counter: %d, beat_thresh: %d\n", beat_counter,
-             beat_thresh);
+    if (engine.soft_sync) {
+      printf("softsync; beat_counter: %d, beat_thresh: %d\n",
+             engine.beat_counter, engine.beat_thresh);
     }
 #endif
-    soft_sync = false;
-    beat_num_total++;
-    beat_counter = 0;
-    beat_onset = true;
-    beat_led = 1 - beat_led;
-    noise_gate_val = 0;
-    if (btn_reset) {
-      beat_led = 1;
-      beat_num_total = 0;
-      btn_reset = false;  // CRITICAL: Must clear this or beat detection fires at 48kHz!
+    engine.soft_sync = false;
+    engine.beat_num_total++;
+    engine.beat_counter = 0;
+    engine.beat_nudge = 0;
+    engine.beat_sample = audio_sample_out();
+    if (engine.beat_length_pending) {
+      engine.beat_length = engine.beat_length_next;
+      engine.beat_length_pending = false;
+    }
+    uint32_t frac = engine.beat_frac + (uint32_t)engine.beat_length;
+    engine.beat_thresh = (engine.beat_length >> 32) + (frac < engine.beat_frac);
+    engine.beat_frac = frac;
+    engine.beat_onset = true;
+    engine.beat_led = 1 - engine.beat_led;
+    engine.noise_gate_val = 0;
+    if (engine.btn_reset || engine.beat_downbeat) {
+      engine.beat_led = 1;
+      engine.beat_num_total = 0;
+      engine.btn_reset = false;  // CRITICAL: Must clear this or beat detection fires at 48kHz!
+      engine.beat_downbeat = false;
     }
     
     // CRITICAL: Advance select_beat IMMEDIATELY when beat is detected
     // Don't wait for the audio_clk condition later
-    select_beat++;
-    if (select_beat >= sample_beats) {
-      select_beat = 0;  // Wrap around
+    engine.select_beat++;
+    if (engine.select_beat >= engine.sample_beats) {
+      engine.select_beat = 0;  // Wrap around
     }
     
-    output_trigger.Trigger();
+    output_trigger.TriggerAt(audio_sample_out(), engine.audio_sample_count);
+#if CLOCK_OUT_ENABLED == 1
+    // reset out marks the start of the loop and any resync to it
+    if (engine.beat_num_total == 0 || engine.select_beat == 0) {
+      reset_out.TriggerAt(audio_sample_out(), engine.audio_sample_count);
+      clock_out.Restart();
+    }
+#endif
 
-    if (do_mute_debounce > 0) {
-      do_mute_debounce--;
+    if (engine.do_mute_debounce > 0) {
+      engine.do_mute_debounce--;
     }
 
     // check button 1
-    if (button_on < NUM_BUTTONS) {
-      if (!input_button[button_on].On()) {
+    if (engine.button_on < NUM_BUTTONS) {
+      if (!input_button[engine.button_on].On()) {
         // button is off
-        button_on = NUM_BUTTONS;
-        button_on2 = NUM_BUTTONS;
-        select_beat_freeze = 0;
-        button_filter_on = false;
+        engine.button_on = NUM_BUTTONS;
+        engine.button_on2 = NUM_BUTTONS;
+        engine.select_beat_freeze = 0;
+        engine.button_filter_on = false;
         // hm
-        retrig_volume_reduce = 0;
-        retrig_volume_reduce_change = 0;  // reset
+        engine.retrig_volume_reduce = 0;
+        engine.retrig_volume_reduce_change = 0;  // reset
 
-        if (btn_reset) {
-          retrig_count = retrig_max;
+        if (engine.btn_reset) {
+          engine.retrig_count = engine.retrig_max;
         }
       }
-    } else if (do_mute_debounce == 0) {
+    } else if (engine.do_mute_debounce == 0) {
       for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
         if (input_button[i].On()) {
-          if (button_on >= NUM_BUTTONS) {
-            select_beat_freeze = (select_beat / NUM_BUTTONS) * NUM_BUTTONS;
+          if (engine.button_on >= NUM_BUTTONS) {
+            engine.select_beat_freeze =
+                (engine.select_beat / NUM_BUTTONS) * NUM_BUTTONS;
           }
-          button_on = i;
+          engine.button_on = i;
 
 // select new beat
 #ifdef DEBUG_BUTTONS
-          printf("%d on\n", button_on);
+          printf("%d on\n", engine.button_on);
 #endif
           break;
         }
@@ -514,127 +841,138 @@ void pwm_interrupt_handler()
     }
 
     // check button 2
-    if (button_on2 < NUM_BUTTONS) {
-      if (!input_button[button_on2].On()) {
-        button_on2 = NUM_BUTTONS;
-        button_filter_on = false;
+    if (engine.button_on2 < NUM_BUTTONS) {
+      if (!input_button[engine.button_on2].On()) {
+        engine.button_on2 = NUM_BUTTONS;
+        engine.button_filter_on = false;
       }
     }
-    if (!btn_retrig) {
+    if (!engine.btn_retrig) {
       // check button 2
-      if (button_on < NUM_BUTTONS && do_mute_debounce == 0) {
+      if (engine.button_on < NUM_BUTTONS && engine.do_mute_debounce == 0) {
         // 1st button pressed, check for second button
         for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
-          if (i == button_on) {
+          if (i == engine.button_on) {
             continue;
           }
           if (input_button[i].On()) {
 #ifdef DEBUG_BUTTONS
-            printf("%d + %d\n", button_on, i);
+            printf("%d + %d\n", engine.button_on, i);
 #endif
-            btn_retrig = true;
-            button_on2 = i;
+            engine.btn_retrig = true;
+            engine.button_on2 = i;
           }
         }
       } else {
-        if (randint(0, 254) < probability_retrig) {
-          btn_retrig = true;
+        if (randint(0, 254) < engine.probability_retrig) {
+          engine.btn_retrig = true;
         }
       }
-    } else if (btn_retrig) {
+    } else if (engine.btn_retrig) {
       // turn off retrig if one of the buttons is released
-      if (button_on == NUM_BUTTONS || button_on2 == NUM_BUTTONS) {
-        retrig_count = retrig_max;
+      if (engine.button_on == NUM_BUTTONS || engine.button_on2 == NUM_BUTTONS) {
+        engine.retrig_count = engine.retrig_max;
       }
     }
-    if (!fx_retrig) {
+    if (!engine.fx_retrig) {
 #ifdef DEBUG_PWM
-      printf("[%d bpm / %d thresh / beat_num: %d] ", bpm_set, beat_thresh,
-             beat_num_total);
+      printf("[%d bpm / %d thresh / beat_num: %d] ", engine.bpm_set,
+             engine.beat_thresh, engine.beat_num_total);
 #endif
 
       // check for fx
-      if (btn_retrig && !fx_retrig) {
+      if (engine.btn_retrig && !engine.fx_retrig) {
 #ifdef DEBUG_PWM
         printf("\n");
 #endif
-        fx_retrig = true;
+        engine.fx_retrig = true;
         uint8_t r1 = randint(0, 100);
         uint8_t r2 = randint(0, 100);
         uint8_t r3 = randint(0, 100);
         uint8_t r4 = randint(0, 100);
-        retrig_count = 0;
+        engine.retrig_count = 0;
         // retrig_sel = randint(0, 11);
         // if (retrig_sel == 4) {
         //   retrig_sel = 5;
         // }
-        if (button_on2 >= NUM_BUTTONS) {
-          retrig_sel = randint(2, 16);
+        if (engine.button_on2 >= NUM_BUTTONS) {
+          engine.retrig_sel = randint(2, 16);
         } else {
-          switch (button_on2) {
+          switch (engine.button_on2) {
             case 0:
-              retrig_sel = randint(0, 2);
+              engine.retrig_sel = randint(0, 2);
               break;
             case 1:
-              retrig_sel = randint(2, 4);
+              engine.retrig_sel = randint(2, 4);
               break;
             case 2:
-              retrig_sel = randint(4, 6);
+              engine.retrig_sel = randint(4, 6);
               break;
             case 3:
-              retrig_sel = randint(6, 8);
+              engine.retrig_sel = randint(6, 8);
               break;
             case 4:
-              retrig_sel = randint(8, 10);
+              engine.retrig_sel = randint(8, 10);
               break;
             case 5:
-              retrig_sel = randint(10, 12);
+              engine.retrig_sel = randint(10, 12);
               break;
             case 6:
-              retrig_sel = randint(12, 14);
+              engine.retrig_sel = randint(12, 14);
               break;
             case 7:
-              retrig_sel = randint(14, 16);
+              engine.retrig_sel = randint(14, 16);
               break;
           }
         }
-        retrig_max = randint(3, 16);
-        if (retrig_sel < 6) {
-          retrig_max = retrig_max / 2;
-        } else if (retrig_sel > 11) {
-          retrig_max = retrig_max * 2;
+        engine.retrig_max = randint(3, 16);
+        if (engine.retrig_sel < 6) {
+          engine.retrig_max = engine.retrig_max / 2;
+        } else if (engine.retrig_sel > 11) {
+          engine.retrig_max = engine.retrig_max * 2;
         }
         if (r1 <= 15) {
-          retrig_pitch_up = true;
+          engine.retrig_pitch_up = true;
         } else if (r2 <= 15) {
-          retrig_pitch_down = true;
+          engine.retrig_pitch_down = true;
         }
         if (r3 < 30) {
-          retrig_filter = retrig_max;
-          retrig_filter_change = (LPF_MAX - 10) / retrig_max;
+          engine.retrig_filter = engine.retrig_max;
+          engine.retrig_filter_change = (LPF_MAX - 10) / engine.retrig_max;
         }
-        if (r4 < 20 && retrig_sel > 6) {
-          retrig_volume_reduce = retrig_max;
-          if (retrig_volume_reduce > 5) {
-            retrig_volume_reduce = 5;
+        if (r4 < 20 && engine.retrig_sel > 6) {
+          engine.retrig_volume_reduce = engine.retrig_max;
+          if (engine.retrig_volume_reduce > 5) {
+            engine.retrig_volume_reduce = 5;
           }
-          retrig_volume_reduce_change = 1;  // volume increases
+          engine.retrig_volume_reduce_change = 1;  // volume increases
           if (randint(1, 100) < 30) {
             // delay fx
-            retrig_volume_reduce_change = 2;  // volume decreases
-            retrig_volume_reduce = 1;
+            engine.retrig_volume_reduce_change = 2;  // volume decreases
+            engine.retrig_volume_reduce = 1;
           }
         }
-        audio_clk = audio_clk_thresh - 1;
-        phase_retrig = (retrigs[retrig_sel] << flag_half_time) - 1;
+        engine.audio_clk = engine.audio_clk_thresh - 1;
+        engine.phase_retrig =
+            (retrigs[engine.retrig_sel] << engine.flag_half_time) - 1;
       }
     }
   }
 
+#if MIDI_CLOCK_OUT_ENABLED == 1
+  midi_clock_out.Tick(engine.beat_counter,
+                      engine.beat_thresh + engine.beat_nudge,
+                      audio_sample_out());
+#endif
+#if CLOCK_OUT_ENABLED == 1
+  clock_out.Tick(engine.beat_counter, engine.beat_thresh + engine.beat_nudge,
+                 audio_sample_out(), engine.audio_sample_count);
+#endif
+
   // disable beat interrupts during fx
   // DIAGNOSTIC: Completely disable fx_retrig system to isolate select_beat issue
-  fx_retrig = false;  // Force off every interrupt
-  btn_retrig = false;
+  engine.fx_retrig = false;  // Force off every interrupt
+  engine.btn_retrig = false;
   
   /*
   static uint32_t fx_retrig_start_time = 0;
@@ -667,30 +1005,36 @@ void pwm_interrupt_handler()
   */
 
   // clocking when to change samples
-  audio_clk++;
-  if (audio_clk == (audio_clk_thresh + retrig_pitch_change + stretch_change) ||
-      beat_onset) {
-    audio_clk = 0;
+  engine.audio_clk++;
+  if (engine.audio_clk == (engine.audio_clk_thresh +
+                           engine.retrig_pitch_change +
+                           engine.stretch_change) ||
+      engine.beat_onset) {
+    engine.audio_clk = 0;
     // beat onset causes next sample
-    if (beat_onset && fx_retrig == false) {
+    if (engine.beat_onset && engine.fx_retrig == false) {
       bool do_switch_heads = true;
 
-      if (probability_tunnel > 0) {
-        if (randint(0, 255) < probability_tunnel) {
-          sample_add = randint(0, NUM_SAMPLES);
+      if (engine.probability_tunnel > 0) {
+        if (randint(0, 255) < engine.probability_tunnel) {
+          engine.sample_add = randint(0, raw_count());
         } else {
-          sample_add = 0;
+          engine.sample_add = 0;
         }
       } else {
-        sample_add = 0;
+        engine.sample_add = 0;
       }
-      if (sample_set != sample_change) {
-        sample_set = sample_change;
+      if (engine.sample_set != engine.sample_change) {
+        engine.sample_set = engine.sample_change;
+      }
+      engine.sample = (engine.sample_set + engine.sample_add) % raw_count();
+      engine.sample_beats = raw_beats(engine.sample);
+      if (engine.select_beat >= engine.sample_beats) {
+        // tunneled into a sample with fewer beats
+        engine.select_beat = engine.select_beat % engine.sample_beats;
       }
-      sample = (sample_set + sample_add) % NUM_SAMPLES;
-      sample_beats = raw_beats(sample);
 
-      beat_onset = false;
+      engine.beat_onset = false;
       
       // NOTE: select_beat++ now happens earlier (in beat detection block)
       // to ensure it always advances. This block used to do it but had issues.
@@ -735,14 +1079,15 @@ void pwm_interrupt_handler()
       */
 
       // random gate
-      if (probability_gate > 0) {
-        if (randint(0, 255) < probability_gate) {
-          noise_gate_thresh_use = SAMPLES_PER_BEAT * randint(800, 1000) / 1000;
+      if (engine.probability_gate > 0) {
+        if (randint(0, 255) < engine.probability_gate) {
+          engine.noise_gate_thresh_use =
+              sample_bank.SamplesPerBeat() * randint(800, 1000) / 1000;
         } else {
-          noise_gate_thresh_use = noise_gate_thresh;
+          engine.noise_gate_thresh_use = engine.noise_gate_thresh;
         }
       } else {
-        noise_gate_thresh_use = noise_gate_thresh;
+        engine.noise_gate_thresh_use = engine.noise_gate_thresh;
       }
 
       // DISABLED: reset was interfering with LED cycling
@@ -781,206 +1126,220 @@ void pwm_interrupt_handler()
       }
       */
 #ifdef DEBUG_PWM
-      printf("select_beat:%d for %d samples\n", select_beat,
-             retrigs[retrig_sel] << flag_half_time);
+      printf("select_beat:%d for %d samples\n", engine.select_beat,
+             retrigs[engine.retrig_sel] << engine.flag_half_time);
 #endif
-      MidiOut_on(midiout, midi_notes_set[(select_beat % 8)], 127);
+      MidiOut_on(midiout, midi_notes_set[(engine.select_beat % 8)], 127,
+                 audio_sample_out());
 
       if (do_switch_heads) {
-        phase_head = 1 - phase_head;  // switch heads
-        phase_xfade = 1 << HEAD_SHIFT;
+        engine.phase_head = 1 - engine.phase_head;  // switch heads
+        engine.phase_xfade = 1 << HEAD_SHIFT;
       }
-      phase_sample[phase_head] =
-          select_beat * (SAMPLES_PER_BEAT << flag_half_time);
+      engine.phase_sample[engine.phase_head] =
+          beat_position(engine.sample, engine.select_beat);
+      // the old head may still point into a longer sample
+      engine.phase_sample[1 - engine.phase_head] =
+          engine.phase_sample[1 - engine.phase_head] % raw_len(engine.sample);
 
       // random direction for the new head
-      if (probability_direction > 0) {
+      if (engine.probability_direction > 0) {
         uint8_t r1 = randint(0, 255);
-        if (direction[phase_head] == base_direction) {
-          if (r1 < probability_direction) {
-            direction[phase_head] = 1 - base_direction;
+        if (engine.direction[engine.phase_head] == engine.base_direction) {
+          if (r1 < engine.probability_direction) {
+            engine.direction[engine.phase_head] = 1 - engine.base_direction;
           }
         } else {
-          if (r1 > probability_direction) {
-            direction[phase_head] = base_direction;
+          if (r1 > engine.probability_direction) {
+            engine.direction[engine.phase_head] = engine.base_direction;
           }
         }
       } else {
-        direction[phase_head] = base_direction;
+        engine.direction[engine.phase_head] = engine.base_direction;
       }
     } else {
       // update the sample
-      noise_gate_val++;
-      if (noise_gate_val < 10 & noise_gate_fade > 0) {
+      engine.noise_gate_val++;
+      if (engine.noise_gate_val < 10 & engine.noise_gate_fade > 0) {
         // noise gate fade in
-        noise_gate_fade--;
-      } else if (noise_gate_val > noise_gate_thresh_use) {
+        engine.noise_gate_fade--;
+      } else if (engine.noise_gate_val > engine.noise_gate_thresh_use) {
         // noise gate fade out
-        if (noise_gate_val % 100 == 0) {
-          if (noise_gate_fade < 8) {
-            noise_gate_fade++;
+        if (engine.noise_gate_val % 100 == 0) {
+          if (engine.noise_gate_fade < 8) {
+            engine.noise_gate_fade++;
           }
         }
       }
       for (uint8_t i = 0; i < 2; i++) {
-        if (direction[i]) {
-          phase_sample[i]++;
-          uint32_t max_len = raw_len(sample);
-          if (phase_sample[i] >= max_len) {
+        if (engine.direction[i]) {
+          engine.phase_sample[i]++;
+          uint32_t max_len = raw_len(engine.sample);
+          if (engine.phase_sample[i] >= max_len) {
+#ifdef DEBUG_PWM
             // Debug: Print wraparound events
             static uint32_t wrap_counter = 0;
             if (++wrap_counter <= 5) {  // Print first 5 wraps
-              printf("[WRAP] phase[%d] wrapped from %lu to 0 (max=%lu)\n", i, phase_sample[i], max_len);
+              printf("[WRAP] phase[%d] wrapped from %lu to 0 (max=%lu)\n", i, engine.phase_sample[i], max_len);
             }
-            phase_sample[i] = 0;
+#endif
+            engine.phase_sample[i] = 0;
           }
         } else {
-          if (phase_sample[i] == 0) {
-            phase_sample[i] = raw_len(sample) - 1;
+          if (engine.phase_sample[i] == 0) {
+            engine.phase_sample[i] = raw_len(engine.sample) - 1;
           } else {
-            phase_sample[i]--;
+            engine.phase_sample[i]--;
           }
         }
       }
     }
 
-    if (fx_retrig) {
-      phase_retrig++;
+    if (engine.fx_retrig) {
+      engine.phase_retrig++;
 
       // prevent noise gating?
-      noise_gate_fade = 0;
-      noise_gate_val = 0;
-
-      if (phase_retrig % (retrigs[retrig_sel] << flag_half_time) == 0) {
-        retrig_count++;
-        if (retrig_filter > 0) {
-          retrig_filter--;
+      engine.noise_gate_fade = 0;
+      engine.noise_gate_val = 0;
+
+      if (engine.phase_retrig %
+              (retrigs[engine.retrig_sel] << engine.flag_half_time) ==
+          0) {
+        engine.retrig_count++;
+        if (engine.retrig_filter > 0) {
+          engine.retrig_filter--;
         }
 
-        MidiOut_on(midiout, midi_notes_set[(select_beat % 8)],
-                   120 * retrig_count / retrig_max);
+        MidiOut_on(midiout, midi_notes_set[(engine.select_beat % 8)],
+                   120 * engine.retrig_count / engine.retrig_max,
+                   audio_sample_out());
 
         // printf("retrig_volume_reduce_change: %d\n",
         //        retrig_volume_reduce_change);
         // printf("retrig_volume_reduce: %d\n", retrig_volume_reduce);
 
-        if (retrig_volume_reduce_change == 1 && retrig_volume_reduce > 0) {
-          if (retrig_sel > 11) {
-            if (retrig_count % 2 == 0) {
-              retrig_volume_reduce--;
+        if (engine.retrig_volume_reduce_change == 1 &&
+            engine.retrig_volume_reduce > 0) {
+          if (engine.retrig_sel > 11) {
+            if (engine.retrig_count % 2 == 0) {
+              engine.retrig_volume_reduce--;
             }
           } else {
-            retrig_volume_reduce--;
+            engine.retrig_volume_reduce--;
           }
-        } else if (retrig_volume_reduce_change == 2 &&
-                   retrig_volume_reduce < 8 && retrig_count % 2 == 0) {
-          if (retrig_sel > 11) {
-            if (retrig_count % 4 == 0) {
-              retrig_volume_reduce++;
+        } else if (engine.retrig_volume_reduce_change == 2 &&
+                   engine.retrig_volume_reduce < 8 &&
+                   engine.retrig_count % 2 == 0) {
+          if (engine.retrig_sel > 11) {
+            if (engine.retrig_count % 4 == 0) {
+              engine.retrig_volume_reduce++;
             }
           } else {
-            retrig_volume_reduce++;
+            engine.retrig_volume_reduce++;
           }
         }
-        if (retrig_pitch_up) {
-          retrig_pitch_change++;
-        } else if (retrig_pitch_down) {
-          retrig_pitch_change--;
+        if (engine.retrig_pitch_up) {
+          engine.retrig_pitch_change++;
+        } else if (engine.retrig_pitch_down) {
+          engine.retrig_pitch_change--;
         }
-        if (retrig_count >= retrig_max) {
+        if (engine.retrig_count >= engine.retrig_max) {
           // reset retrig stuff
-          retrig_filter = 0;
-          retrig_pitch_up = false;
-          retrig_pitch_down = false;
-          retrig_pitch_change = 0;
-          retrig_volume_reduce = 0;
-          retrig_volume_reduce_change = 0;
-          button_filter_on = false;
-          fx_retrig = false;
-          btn_retrig = false;
+          engine.retrig_filter = 0;
+          engine.retrig_pitch_up = false;
+          engine.retrig_pitch_down = false;
+          engine.retrig_pitch_change = 0;
+          engine.retrig_volume_reduce = 0;
+          engine.retrig_volume_reduce_change = 0;
+          engine.button_filter_on = false;
+          engine.fx_retrig = false;
+          engine.btn_retrig = false;
         }
 #ifdef DEBUG_PWM
         printf(
             "[retrig %d/%d] select_beat:%d for %d samples, beat_counter: %d, "
             "\n\tphase_sample[phase_head]: %d%%%d==0\n",
-            retrig_count, retrig_max, select_beat,
-            retrigs[retrig_sel] << flag_half_time, beat_counter,
-            phase_sample[phase_head], (retrigs[retrig_sel] << flag_half_time));
+            engine.retrig_count, engine.retrig_max, engine.select_beat,
+            retrigs[engine.retrig_sel] << engine.flag_half_time,
+            engine.beat_counter, engine.phase_sample[engine.phase_head],
+            (retrigs[engine.retrig_sel] << engine.flag_half_time));
 #endif
         // setup
-        phase_head = 1 - phase_head;  // switch heads
-        phase_xfade = 1 << HEAD_SHIFT;
-        phase_sample[phase_head] =
-            select_beat * (SAMPLES_PER_BEAT << flag_half_time);
-        phase_retrig = 0;
+        engine.phase_head = 1 - engine.phase_head;  // switch heads
+        engine.phase_xfade = 1 << HEAD_SHIFT;
+        engine.phase_sample[engine.phase_head] =
+            beat_position(engine.sample, engine.select_beat);
+        engine.phase_retrig = 0;
       }
     }
 
     // determine sample
-    if (phase_xfade == 0) {
-      audio_now = raw_val(sample, phase_sample[phase_head]);
+    if (engine.phase_xfade == 0) {
+      engine.audio_now =
+          raw_val(engine.sample, engine.phase_sample[engine.phase_head]);
     } else {
-      phase_xfade--;
+      engine.phase_xfade--;
 
       // new head
-      uint32_t u = (uint32_t)raw_val(sample, phase_sample[phase_head]);
-      u = u * ((1 << HEAD_SHIFT) - phase_xfade);  // fade it in
+      uint32_t u = (uint32_t)raw_val(engine.sample,
+                                     engine.phase_sample[engine.phase_head]);
+      u = u * ((1 << HEAD_SHIFT) - engine.phase_xfade);  // fade it in
 
       // old head
-      uint32_t v = (uint32_t)raw_val(sample, phase_sample[1 - phase_head]);
-      v = v * phase_xfade;  // fade it out
+      uint32_t v = (uint32_t)raw_val(
+          engine.sample, engine.phase_sample[1 - engine.phase_head]);
+      v = v * engine.phase_xfade;  // fade it out
 
       // combine
       u = (u + v) >> HEAD_SHIFT;
 
       // set to audio now
-      audio_now = (uint8_t)u;
+      engine.audio_now = (uint8_t)u;
       // if (phase_xfade == 1 << HEAD_SHIFT - 1) {
       //   // printf("\nphase_head: %d; audio_now=%d\n", phase_head, u);
       // }
     }
 
     // <volume>
-    if (volume_reduce >= VOLUME_REDUCE_MAX) audio_now = 128;
-    if (audio_now != 128) {
+    if (engine.volume_reduce >= VOLUME_REDUCE_MAX) engine.audio_now = 128;
+    if (engine.audio_now != 128) {
       // distortion / wave-folding
-      if (distortion > 0) {
-        if (audio_now > 128) {
-          if (audio_now < (255 - distortion)) {
-            audio_now += distortion;
+      if (engine.distortion > 0) {
+        if (engine.audio_now > 128) {
+          if (engine.audio_now < (255 - engine.distortion)) {
+            engine.audio_now += engine.distortion;
           } else {
-            audio_now = 255 - distortion;
+            engine.audio_now = 255 - engine.distortion;
           }
-          audio_now = 128 + ((audio_now - 128) / ((distortion >> 4) + 1));
+          engine.audio_now = 128 + ((engine.audio_now - 128) /
+                                    ((engine.distortion >> 4) + 1));
         } else {
-          if (audio_now > distortion) {
-            audio_now -= distortion;
+          if (engine.audio_now > engine.distortion) {
+            engine.audio_now -= engine.distortion;
           } else {
-            audio_now = distortion - audio_now;
+            engine.audio_now = engine.distortion - engine.audio_now;
           }
-          audio_now = 128 - ((128 - audio_now) / ((distortion >> 4) + 1));
+          engine.audio_now = 128 - ((128 - engine.audio_now) /
+                                    ((engine.distortion >> 4) + 1));
         }
       }
       // reduce volume
-      if (volume_reduce > 0) {
-        if (audio_now > 128) {
-          audio_now = audio_now - (volume_reduce);
-          if (audio_now < 128) audio_now = 128;
+      if (engine.volume_reduce > 0) {
+        if (engine.audio_now > 128) {
+          engine.audio_now = engine.audio_now - (engine.volume_reduce);
+          if (engine.audio_now < 128) engine.audio_now = 128;
         } else {
-          audio_now = audio_now + (volume_reduce);
-          if (audio_now > 128) audio_now = 128;
+          engine.audio_now = engine.audio_now + (engine.volume_reduce);
+          if (engine.audio_now > 128) engine.audio_now = 128;
         }
       }
-      if ((volume_mod + retrig_volume_reduce + noise_gate_fade) > 0 &&
-          audio_now != 128) {
-        if (audio_now > 128) {
-          audio_now = ((audio_now - 128) >>
-                       (volume_mod + retrig_volume_reduce + noise_gate_fade)) +
-                      128;
+      int shift = engine.volume_mod + engine.retrig_volume_reduce +
+                  engine.noise_gate_fade;
+      if (shift > 0 && engine.audio_now != 128) {
+        if (engine.audio_now > 128) {
+          engine.audio_now = ((engine.audio_now - 128) >> shift) + 128;
         } else {
-          audio_now =
-              128 - ((128 - audio_now) >>
-                     (volume_mod + retrig_volume_reduce + noise_gate_fade));
+          engine.audio_now = 128 - ((128 - engine.audio_now) >> shift);
         }
       }
     }  // </volume>
@@ -996,12 +1355,12 @@ void pwm_interrupt_handler()
     // </bitcrush>
 
     // <filter>
-    if ((filter_fc - (retrig_filter * retrig_filter_change) - button_filter) <=
-        LPF_MAX) {
-      audio_now = (uint8_t)filter_lpf(
-          (int64_t)audio_now,
-          (filter_fc - (retrig_filter * retrig_filter_change) - button_filter),
-          filter_q);
+    int32_t fc = engine.filter_fc -
+                 (engine.retrig_filter * engine.retrig_filter_change) -
+                 engine.button_filter;
+    if (fc <= LPF_MAX) {
+      engine.audio_now =
+          (uint8_t)filter_lpf((int64_t)engine.audio_now, fc, engine.filter_q);
       // } else {
       // audio_now = (uint8_t)filter_lpf((int64_t)audio_now, LPF_MAX, filter_q);
     }
@@ -1018,13 +1377,33 @@ void pwm_interrupt_handler()
 
 #if I2S_AUDIO_ENABLED == 1
   if (i2s_audio.CanWrite()) {
-    i2s_audio.WriteSample(audio_now);
+    i2s_audio.WriteSample(engine.audio_now);
   }
 #else
-  pwm_set_gpio_level(AUDIO_PIN, audio_now);
+  pwm_set_gpio_level(AUDIO_PIN, engine.audio_now);
 #endif
 }
 
+#if I2S_AUDIO_ENABLED == 1
+// audio_preroll renders lead samples ahead of the output into the bridge
+// queue, a burst of engine ticks instead of waiting for the queue to fill,
+// so the output never slows down. The output keeps playing from the queue
+// during the burst, so it may take more ticks than lead. The burst does not
+// count as time passing: it adds to engine.audio_lead instead of
+// audio_sample_count, and midi and pulses it renders wait for their audio.
+void audio_preroll(uint16_t lead) {
+  i2s_audio.Hold(lead);
+  for (uint32_t i = 0; i < 4 * I2S_AUDIO_BRIDGE_SIZE && !i2s_audio.Held();
+       i++) {
+    uint32_t ints = save_and_disable_interrupts();
+    engine.audio_prerolling = true;
+    audio_interrupt_handler();
+    engine.audio_prerolling = false;
+    restore_interrupts(ints);
+  }
+}
+#endif
+
 void print_buf(const uint8_t *buf, size_t len) {
   for (size_t i = 0; i < len; ++i) {
     printf("%02x", buf[i]);
@@ -1035,30 +1414,38 @@ void print_buf(const uint8_t *buf, size_t len) {
   }
 }
 
-void do_stop_everything() { do_mute = true; }
+void do_stop_everything() {
+  engine.do_mute = true;
+#if MIDI_CLOCK_OUT_ENABLED == 1
+  midi_clock_out.Stop();
+#endif
+}
 void do_start_everything() {
+#if MIDI_CLOCK_OUT_ENABLED == 1
+  midi_clock_out.Start();
+#endif
   // reset syncing
-  is_syncing = false;
+  engine.is_syncing = false;
   syncing_clicks = 0;
-  do_mute_debounce = 8;
-  button_on = NUM_BUTTONS;
-  button_on2 = NUM_BUTTONS;
-  btn_reset = true;
+  engine.do_mute_debounce = 8;
+  engine.button_on = NUM_BUTTONS;
+  engine.button_on2 = NUM_BUTTONS;
+  engine.btn_reset = true;
   // reset everything
   // reset retrig stuff
-  retrig_filter = 0;
-  retrig_pitch_up = false;
-  retrig_pitch_down = false;
-  retrig_pitch_change = 0;
-  retrig_volume_reduce = 0;
-  retrig_volume_reduce_change = 0;
-  button_filter_on = false;
-  fx_retrig = false;
-  btn_retrig = false;
-  do_mute = false;
+  engine.retrig_filter = 0;
+  engine.retrig_pitch_up = false;
+  engine.retrig_pitch_down = false;
+  engine.retrig_pitch_change = 0;
+  engine.retrig_volume_reduce = 0;
+  engine.retrig_volume_reduce_change = 0;
+  engine.button_filter_on = false;
+  engine.fx_retrig = false;
+  engine.btn_retrig = false;
+  engine.do_mute = false;
 }
 
-#if MIDI_IN_ENABLED == 1
+// midi in, from one wire midi and/or usb
 uint32_t current_time() { return to_ms_since_boot(get_absolute_time()); }
 
 uint16_t *sort_int32_t(uint32_t array[], int n) {
@@ -1088,12 +1475,12 @@ uint16_t *sort_int32_t(uint32_t array[], int n) {
 
 uint32_t note_hit[MIDI_MAX_NOTES];
 bool note_on[MIDI_MAX_NOTES];
-uint32_t midi_last_time = 0;
-uint32_t midi_delta_sum = 0;
-uint32_t midi_delta_count = 0;
-#define MIDI_DELTA_COUNT_MAX 32
 uint32_t midi_timing_count = 0;
 const uint8_t midi_timing_modulus = 24;
+// 24 edges per beat average out jitter with a slower loop than clock in
+#define MIDI_PLL_KP_SHIFT 4
+#define MIDI_PLL_KI_SHIFT 9
+TempoPLL midi_pll;
 
 void midi_note_off(uint8_t note) {
 #ifdef DEBUG_MIDI
@@ -1128,65 +1515,63 @@ void midi_start() {
   printf("midi start\n");
 #endif
   do_start_everything();
-  soft_sync = false;
-  btn_reset = false;
+  engine.soft_sync = false;
+  engine.btn_reset = false;
   midi_timing_count = 24 * MIDI_RESET_EVERY_BEAT - 1;
+  // the beat restarts on the first clock, not wherever the loop was
+  midi_pll.Reset();
 }
 void midi_continue() {
 #ifdef DEBUG_MIDI
   printf("midi continue (starting)\n");
 #endif
   do_start_everything();
-  soft_sync = false;
-  btn_reset = false;
+  engine.soft_sync = false;
+  engine.btn_reset = false;
   midi_timing_count = 24 * MIDI_RESET_EVERY_BEAT - 1;
+  // the beat restarts on the first clock, not wherever the loop was
+  midi_pll.Reset();
 }
 void midi_stop() {
 #ifdef DEBUG_MIDI
   printf("midi stop\n");
 #endif
   do_stop_everything();
-  soft_sync = false;
-  btn_reset = false;
+  engine.soft_sync = false;
+  engine.btn_reset = false;
   midi_timing_count = 24 * MIDI_RESET_EVERY_BEAT - 1;
 }
-void midi_timing() {
+void midi_timing(uint64_t time_us) {
   midi_timing_count++;
-  if (midi_timing_count % (24 * MIDI_RESET_EVERY_BEAT) == 0) {
-    btn_reset = true;
+  bool on_beat = midi_timing_count %
+                     (midi_timing_modulus / MIDI_CLOCK_MULTIPLIER) ==
+                 0;
+  bool downbeat = midi_timing_count % (24 * MIDI_RESET_EVERY_BEAT) == 0;
 #ifdef DEBUG_MIDI
+  if (downbeat) {
     printf("midi resetting");
-#endif
-  } else if (midi_timing_count %
-                 (midi_timing_modulus / MIDI_CLOCK_MULTIPLIER) ==
-             0) {
-    soft_sync = true;
   }
-  uint32_t now_time = time_us_32();
-  if (midi_last_time > 0) {
-    midi_delta_sum += now_time - midi_last_time;
-    midi_delta_count++;
-    if (midi_delta_count == MIDI_DELTA_COUNT_MAX) {
-      uint32_t bpm_input =
-          (int)round(1250000.0 * MIDI_CLOCK_MULTIPLIER * MIDI_DELTA_COUNT_MAX /
-                     (float)(midi_delta_sum));
-#ifdef DEBUG_MIDI
-      printf("midi bpm\t%d\n", bpm_input);
-#endif
-      if (bpm_input - 7 != bpm_set) {
-        // #ifdef DEBUG_CLOCK
-        //         printf("%d, %d\n", clock_sync_ms, bpm_input);
-        // #endif
-        // REDUCE THE BPM INPUT TO ELIMINATE OVERSTEPPING
-        param_set_bpm(bpm_input - 7, bpm_set, beat_thresh, audio_clk_thresh);
-      }
-      midi_delta_count = 0;
-      midi_delta_sum = 0;
-    }
+#endif
+  // usb midi clocks read in one batch after the first have no time
+  if (time_us == 0) {
+    midi_pll.Coast();
+  } else {
+    midi_pll.Update(sample_at(time_us));
   }
-  midi_last_time = now_time;
+  beat_follow(midi_pll, 2 * midi_timing_modulus / MIDI_CLOCK_MULTIPLIER,
+              on_beat, downbeat);
 }
+
+// pulse_outputs_init starts the pulse outputs on pio1 next to the i2s state
+// machine, before the audio interrupt that triggers them
+void pulse_outputs_init() {
+  output_trigger.Init(pio1, TRIGO_PIN, TRIGGER_OUT_PULSE_US);
+#if CLOCK_OUT_ENABLED == 1
+  clock_out.Init(pio1, CLOCK_OUT_PIN, CLOCK_OUT_PULSE_US, CLOCK_OUT_MULTIPLY,
+                 CLOCK_OUT_DIVIDE);
+  reset_out.Init(pio1, RESET_OUT_PIN, CLOCK_OUT_PULSE_US);
 #endif
+}
 
 int main(void) {
   
@@ -1200,20 +1585,22 @@ int main(void) {
   printf("Sample Rate: %d Hz\n", SAMPLE_RATE);
   printf("System Clock: %d kHz (%d MHz)\n", SYSTEM_CLOCK_KHZ, SYSTEM_CLOCK_KHZ/1000);
 
+  sample_bank_init();
+
   // initialize bpm
-  param_set_bpm(BPM_SAMPLED, bpm_set, beat_thresh, audio_clk_thresh);
+  param_set_bpm(BPM_SAMPLED, engine.bpm_set, engine.audio_clk_thresh);
   
   // Initialize sample tracking
-  sample = 0;
-  sample_beats = raw_beats(sample);  // Set to actual beat count (32 for amen break)
-  uint32_t sample_len = raw_len(sample);
+  engine.sample = 0;
+  engine.sample_beats = raw_beats(engine.sample);  // Set to actual beat count (32 for amen break)
+  uint32_t sample_len = raw_len(engine.sample);
   printf("=== INITIALIZATION ===\n");
-  printf("  BPM: %d\n", bpm_set);
-  printf("  beat_thresh: %lu samples (%d ms)\n", beat_thresh, (beat_thresh * 1000) / SAMPLE_RATE);
-  printf("  audio_clk_thresh: %d\n", audio_clk_thresh);
-  printf("  sample: %d, sample_beats: %d, sample_len: %lu\n", sample, sample_beats, sample_len);
+  printf("  BPM: %d\n", engine.bpm_set);
+  printf("  beat_thresh: %lu samples (%d ms)\n", engine.beat_thresh, (engine.beat_thresh * 1000) / SAMPLE_RATE);
+  printf("  audio_clk_thresh: %d\n", engine.audio_clk_thresh);
+  printf("  sample: %d, sample_beats: %d, sample_len: %lu\n", engine.sample, engine.sample_beats, sample_len);
   printf("  SAMPLES_PER_BEAT: %d\n", SAMPLES_PER_BEAT);
-  printf("  phase_sample[0]: %lu, phase_sample[1]: %lu\n", phase_sample[0], phase_sample[1]);
+  printf("  phase_sample[0]: %lu, phase_sample[1]: %lu\n", engine.phase_sample[0], engine.phase_sample[1]);
   printf("======================\n");
 
   // Initialize LEDs
@@ -1230,6 +1617,14 @@ int main(void) {
   gpio_set_dir(LED_PIN, GPIO_OUT);
   // Removed onboard LED blink at startup
 
+  // midi clock out, runs from the audio interrupt
+#if MIDI_CLOCK_OUT_ENABLED == 1
+  midi_clock_out.Init();
+#endif
+#if MIDI_UART_OUT_ENABLED == 1
+  midi_uart_out.Init(pio0, MIDI_UART_OUT_PIN);
+#endif
+
 #if I2S_AUDIO_ENABLED == 1
   // Initialize I2S audio output via PIO
   // Use pio1 (pio0 is used by WS2812 if enabled)
@@ -1238,6 +1633,7 @@ int main(void) {
   i2s_audio.Init(SAMPLE_RATE, pio1, 0, I2S_DATA_PIN, I2S_BCK_PIN, I2S_LCK_PIN);
   i2s_audio.Start();
   printf("I2S audio started\n");
+  pulse_outputs_init();
   
   // Setup hardware timer for sample rate interrupt
   // Using negative period for precise timing
@@ -1267,6 +1663,7 @@ int main(void) {
     printf("LED should now blink at 4 Hz if timer callback is working\n");
   }
 #else
+  pulse_outputs_init();
   // Initialize PWM audio output
   gpio_set_function(AUDIO_PIN, GPIO_FUNC_PWM);
   int audio_pin_slice = pwm_gpio_to_slice_num(AUDIO_PIN);
@@ -1289,10 +1686,11 @@ int main(void) {
   pwm_set_gpio_level(AUDIO_PIN, 0);
 #endif
 
-  // setup gpio pins
-  gpio_init(CLOCK_IN_PIN);
-  gpio_set_dir(CLOCK_IN_PIN, GPIO_IN);
-  gpio_pull_down(CLOCK_IN_PIN);
+  // setup gpio pins, clock and reset in are timed by interrupt
+#if MIDI_IN_ENABLED == 0
+  clock_in.Init(CLOCK_IN_PIN);
+#endif
+  reset_in.Init(RESET_IN_PIN);
   gpio_init(23);
   gpio_pull_up(23);
   gpio_set_dir(23, GPIO_OUT);
@@ -1300,7 +1698,7 @@ int main(void) {
 
   // initialize buttons
   for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
-    input_button[i].Init(i + 4, 10);  // GPIO 4 through 11 are buttons
+    input_button[i].Init(i + 4, 5);  // GPIO 4 through 11, 20 ms debounce
   }
 
   // initialize knobs
@@ -1324,6 +1722,13 @@ int main(void) {
   // initialize sequencer
   sequencer.Init();
 
+  // find the newest saved settings
+  settings_store.Init(SETTINGS_OFFSET, flash_image_end());
+  if (!settings_store.Enabled()) {
+    printf("settings DISABLED: firmware ends at %lu, past %d\n",
+           flash_image_end(), SETTINGS_OFFSET);
+  }
+
   // initialize save data
   uint8_t save_data[FLASH_PAGE_SIZE];
   // // save defaults that aren't defaulted to 0
@@ -1331,17 +1736,13 @@ int main(void) {
   save_data[SAVE_VOLUME + 1] = (uint8_t)2500;
   save_data[SAVE_BPM] = (uint8_t)(165 >> 8);
   save_data[SAVE_BPM + 1] = (uint8_t)165;
-  noise_gate_thresh = SAMPLES_PER_BEAT * 4;
-  noise_gate_thresh_use = noise_gate_thresh;
-  save_data[SAVE_GATE] = (uint8_t)(noise_gate_thresh >> 8);
-  save_data[SAVE_GATE + 1] = (uint8_t)noise_gate_thresh;
-
-  // initializer trigger
-  output_trigger.Init(TRIGO_PIN, 10, MAIN_LOOP_HZ);
+  engine.noise_gate_thresh = SAMPLES_PER_BEAT * 4;
+  engine.noise_gate_thresh_use = engine.noise_gate_thresh;
+  save_data[SAVE_GATE] = (uint8_t)(engine.noise_gate_thresh >> 8);
+  save_data[SAVE_GATE + 1] = (uint8_t)engine.noise_gate_thresh;
 
   // initialize control loop variables
   uint32_t clock_ms = 0;
-  uint32_t bpm_input = 165;
   uint32_t clock_hits = 0;
   uint32_t clock_sync_ms = 0;
   uint16_t alpha0 = 500;
@@ -1363,21 +1764,33 @@ int main(void) {
   uint32_t debounce_led_save = 0;
   uint8_t debounce_led_sequencer = 0;
   uint8_t debounce_led_load = 0;
-  uint8_t clock_pin_last = 0;
+  uint64_t clock_edge_us = 0;
+  uint64_t clock_last_us = 0;
+  uint64_t reset_edge_us = 0;
   uint8_t last_button_on = NUM_BUTTONS;
   bool has_saved = false;
   bool do_load = false;
   bool first_time = false;
   bool has_loaded = false;
-  RunningAverage ra;
-  ra.Init(5);
+  bool boot_loaded = false;
+  uint64_t tick_last_ms = time_us_64() / 1000;
+  clock_pll.Init();
+  midi_pll.Init(MIDI_PLL_KP_SHIFT, MIDI_PLL_KI_SHIFT);
+
+#if USB_MIDI_IN_ENABLED == 1
+  // usb midi
+  usb_midi_in.Init(midi_note_on, midi_note_off, midi_start, midi_continue,
+                   midi_stop, midi_timing);
+#endif
 
 #if MIDI_IN_ENABLED == 1
 
   // initialize one wire midi
-  onewiremidi =
-      Onewiremidi_new(pio1, 0, CLOCK_IN_PIN, midi_note_on, midi_note_off,
-                      midi_start, midi_continue, midi_stop, midi_timing);
+  // the i2s state machine and the pulse outputs share pio1
+  onewiremidi = Onewiremidi_new(pio1, pio_claim_unused_sm(pio1, true),
+                                CLOCK_IN_PIN, midi_note_on, midi_note_off,
+                                midi_start, midi_continue, midi_stop,
+                                midi_timing);
 #endif
 
 // LED
@@ -1386,51 +1799,97 @@ int main(void) {
       23,    // Data line is connected to pin 0. (GP0)
       1,     // Strip is 6 LEDs long.
       pio0,  // Use PIO 0 for creating the state machine.
-      0,  // Index of the state machine that will be created for controlling the
-          // LED strip You can have 4 state machines per PIO-Block up to 8
-          // overall. See Chapter 3 in:
-          // https://datasheets.raspberrypi.org/rp2040/rp2040-datasheet.pdf
+      // The shift register and the midi uart out also run on pio0, so the
+      // state machine is claimed rather than fixed. See Chapter 3 in:
+      // https://datasheets.raspberrypi.org/rp2040/rp2040-datasheet.pdf
+      pio_claim_unused_sm(pio0, true),
       WS2812::FORMAT_GRB  // Pixel format used by the LED strip
   );
 #endif
 
   // setup usb
   tusb_init();
+#if SAMPLE_UPLOAD_ENABLED == 1
+  sample_upload.Init(SAMPLE_BANK_OFFSET, sample_partition_size());
+#endif
 
   // CRITICAL: Force-reset state variables before main loop
   printf("Initializing playback state...\n");
-  select_beat = 0;  // Start from first beat
-  beat_num_total = 0;
-  fx_retrig = false;
-  btn_retrig = false;
-  probability_retrig = 0;  // Disable random retrig
+  engine.select_beat = 0;  // Start from first beat
+  engine.beat_num_total = 0;
+  engine.fx_retrig = false;
+  engine.btn_retrig = false;
+  engine.probability_retrig = 0;  // Disable random retrig
   printf("  select_beat=%d, sample_beats=%d, fx_retrig=%d\n",
-         select_beat, sample_beats, fx_retrig?1:0);
+         engine.select_beat, engine.sample_beats, engine.fx_retrig?1:0);
   printf("  SAMPLES_PER_BEAT=%d, beat_thresh=%lu\n",
-         SAMPLES_PER_BEAT, beat_thresh);
+         SAMPLES_PER_BEAT, engine.beat_thresh);
 
   // control loop
   printf("Starting main control loop...\n");
-  uint32_t loop_counter = 0;
+  Scheduler scheduler;
+  scheduler.Init();
+  scheduler.Add(TASK_USB, "usb", 1000);
+  scheduler.Add(TASK_CLOCK_IN, "clock in", 250);
+  scheduler.Add(TASK_TICK, "tick", 1000);
+  scheduler.Add(TASK_BUTTONS, "buttons", 4000);  // 250 Hz
+  scheduler.Add(TASK_KNOBS, "knobs", 8000);
+  scheduler.Add(TASK_LEDS, "leds", 10000);
+#ifdef DEBUG_SCHEDULER
+  scheduler.Add(TASK_STATS, "stats", 10000000);
+#endif
   while (1) {
-    loop_counter++;
-    tud_task();
-    sleep_us(MAIN_LOOP_DELAY);  // Fixed 50us delay = 20kHz loop rate
-    
-    // Increment millisecond counter (20kHz / 20 = 1kHz = 1ms)
-    static uint16_t us_counter = 0;
-    us_counter += MAIN_LOOP_DELAY;
-    if (us_counter >= 1000) {
-      us_counter -= 1000;
-      clock_ms++;
-      clock_sync_ms++;
+    scheduler.Wait();
+
+#ifdef DEBUG_SCHEDULER
+    if (scheduler.Due(TASK_STATS)) {
+      scheduler.Print();
+      printf("midi out: %lu transfers, %lu dropped full, %lu dropped usb\n",
+             midiout_queue.transfers, midiout_queue.dropped_full,
+             midiout_queue.dropped_usb);
+#if I2S_AUDIO_ENABLED == 1
+      printf("audio: %lu save underruns\n", i2s_audio.Underruns());
+#endif
+#if MIDI_IN_ENABLED == 1
+      printf("midi in: %lu overruns\n", onewiremidi->overruns);
+#endif
+      scheduler.Done(TASK_STATS);
     }
+#endif
 
-#if MIDI_IN_ENABLED == 1
-    Onewiremidi_receive(onewiremidi);
+    if (scheduler.Due(TASK_USB)) {
+#if USB_MIDI_IN_ENABLED == 1
+      uint64_t usb_time_us = time_us_64();
+      tud_task();
+      usb_midi_in.Task(usb_time_us);
+#else
+      tud_task();
 #endif
+#if MIDI_UART_OUT_ENABLED == 1
+      MidiOut_task(engine.audio_sample_count, midi_uart_copy);
+      midi_uart_out.Pump();
+#else
+      MidiOut_task(engine.audio_sample_count, NULL);
+#endif
+#if SAMPLE_UPLOAD_ENABLED == 1
+      sample_upload.Task();
+      if (sample_upload.Done()) {
+        // start the new bank from its first beat
+        bool ok = sample_bank_init();
+        engine.sample = engine.sample % raw_count();
+        engine.sample_beats = raw_beats(engine.sample);
+        engine.select_beat = 0;
+        engine.phase_sample[0] = 0;
+        engine.phase_sample[1] = 0;
+        engine.phase_xfade = 0;
+        sample_upload.Finish(ok);
+      }
+#endif
+      scheduler.Done(TASK_USB);
+    }
+
+    if (scheduler.Due(TASK_LEDS)) {
 #if WS2812_ENABLED == 1
-    if (clock_ms % 200 == 0) {
       // leds
       // ledStrip.fill(WS2812::RGB(input_knob[0].Value() * 255 / 4095,
       //                           input_knob[1].Value() * 255 / 4095,
@@ -1442,7 +1901,7 @@ int main(void) {
         ledStrip.fill(WS2812::RGB(150, 100, 0));
       } else if (debounce_lock_clock > 0) {
         debounce_lock_clock--;
-        if (do_lock_clock) {
+        if (engine.do_lock_clock) {
           ledStrip.fill(WS2812::RGB(200, 200, 0));
         } else {
           ledStrip.fill(WS2812::RGB(0, 200, 200));
@@ -1450,7 +1909,7 @@ int main(void) {
       } else if (debounce_reset_fx > 0) {
         debounce_reset_fx--;
         ledStrip.fill(WS2812::RGB(200, 200, 200));
-      } else if (do_mute) {
+      } else if (engine.do_mute) {
         ledStrip.fill(WS2812::RGB(255, 0, 50));
       } else if (sequencer.IsRecording()) {
         ledStrip.fill(WS2812::RGB(80, 80, 0));
@@ -1466,11 +1925,12 @@ int main(void) {
         ledStrip.fill(WS2812::RGB(0, 0, ledarray_bar * 80 / 1000));
       } else if (ledarray_bar_debounce == 3) {
         // volume knob
-        if (distortion > 0) {
-          ledStrip.fill(WS2812::RGB(distortion * 3,
-                                    2 * (DISTORTION_MAX - distortion), 0));
-        } else if (volume_reduce > 0) {
-          uint8_t vv = (VOLUME_REDUCE_MAX - volume_reduce) * 4;
+        if (engine.distortion > 0) {
+          ledStrip.fill(
+              WS2812::RGB(engine.distortion * 3,
+                          2 * (DISTORTION_MAX - engine.distortion), 0));
+        } else if (engine.volume_reduce > 0) {
+          uint8_t vv = (VOLUME_REDUCE_MAX - engine.volume_reduce) * 4;
           if (vv > 200) {
             vv = 0;
           }
@@ -1482,93 +1942,138 @@ int main(void) {
         ledStrip.fill(WS2812::RGB(0, 0, 0));
       }
       ledStrip.show();
-    }
 #endif
-
-    if (debounce_sample > 0) {
-      debounce_sample--;
+#if SHIFT_REGISTER_ENABLED == 1
+      // Display current beat position on shift register LEDs
+      // select_beat advances 0-31 for the amen break, we show (select_beat % 8)
+      // NOTE: Onboard LED is toggled in beat detection (audio_interrupt_handler)
+      // If onboard LED blinks at ~5.5 Hz = beat detection working
+      // If onboard LED stays solid = beat detection NOT firing
+      ledarray.Clear();
+    
+      uint8_t led_index = engine.select_beat % 8;
+      ledarray.Set(led_index, 1000);  // Full brightness
+    
+      ledarray.Update();
+#endif
+      scheduler.Done(TASK_LEDS);
     }
-    // flash works
-    if (debounce_saving > 0 && clock_ms > 64000) {
-      debounce_saving--;
-      if (debounce_saving == 0) {
+
+    if (scheduler.Due(TASK_TICK)) {
+      // ms since the last tick, a late tick catches up
+      uint64_t tick_now_ms = time_us_64() / 1000;
+      clock_ms += tick_now_ms - tick_last_ms;
+      clock_sync_ms += tick_now_ms - tick_last_ms;
+      tick_last_ms = tick_now_ms;
+
+      if (debounce_sample > 0) {
+        debounce_sample--;
+      }
+      // flash works
+#if I2S_AUDIO_ENABLED == 1
+      // audio plays from RAM during the write, no need to wait out the
+      // first minute
+      if (debounce_saving > 0) {
+        debounce_saving--;
+#else
+      if (debounce_saving > 0 && clock_ms > 64000) {
+        debounce_saving--;
+#endif
+        if (debounce_saving == 0) {
 #ifdef DEBUG_SAVE
-        printf("\nsaving:\n");
+          printf("\nsaving:\n");
 #endif
-        save_data[FLASH_PAGE_SIZE - 1] = 0x01;
-        save_data[FLASH_PAGE_SIZE - 2] = 0x02;
-        save_data[FLASH_PAGE_SIZE - 3] = 0x03;
-        save_data[FLASH_PAGE_SIZE - 4] = 0x04;
-        sequencer.Save(save_data);
+          sequencer.Save(save_data);
 #ifdef DEBUG_SAVE
-        print_buf(save_data, FLASH_PAGE_SIZE);
+          print_buf(save_data, FLASH_PAGE_SIZE);
+#endif
+#if I2S_AUDIO_ENABLED == 1
+          // queue audio to play by DMA during the write, long enough for
+          // a sector erase when the write starts a sector
+          audio_preroll(settings_store.WillErase() ? I2S_AUDIO_BRIDGE_ERASE
+                                                   : I2S_AUDIO_BRIDGE_PROGRAM);
 #endif
-        uint32_t ints = save_and_disable_interrupts();
-        flash_range_erase(FLASH_TARGET_OFFSET2, FLASH_SECTOR_SIZE);
-        flash_range_program(FLASH_TARGET_OFFSET2, save_data, FLASH_PAGE_SIZE);
-        restore_interrupts(ints);
 #ifdef DEBUG_SAVE
-        printf("saved!\n");
+          bool erase = settings_store.WillErase();
+          uint64_t save_us = time_us_64();
 #endif
-      }
-    }
-    if (clock_ms == 100) {
-      do_load = true;
-      first_time = true;
-    }
-    if (do_load) {
-      do_load = false;
-      ledarray_load = 16000;
-      debounce_saving = 0;
+          uint32_t ints = save_and_disable_interrupts();
+#if I2S_AUDIO_ENABLED == 1
+          i2s_audio.Bridge();
+#endif
+          bool saved = settings_store.Save(save_data);
+          restore_interrupts(ints);
 #ifdef DEBUG_SAVE
-      printf("\n\n\nPICO_FLASH_SIZE_BYTES: \t%d\n", PICO_FLASH_SIZE_BYTES);
-      printf("FLASH_TARGET_OFFSET2: \t%d\n", FLASH_TARGET_OFFSET2);
-      printf("FLASH_PAGE_SIZE: \t%d\n", FLASH_PAGE_SIZE);
-      printf("FLASH_SECTOR_SIZE: \t%d\n", FLASH_SECTOR_SIZE);
-      printf("XIP_BASE: \t%d\n", XIP_BASE);
-      printf("save data:\n");
-      print_buf(flash_target_contents, FLASH_PAGE_SIZE);
-      printf("\nloading saved data: \n");
-#endif
-      if (flash_target_contents[FLASH_PAGE_SIZE - 1] == 0x01 &&
-          flash_target_contents[FLASH_PAGE_SIZE - 2] == 0x02 &&
-          flash_target_contents[FLASH_PAGE_SIZE - 3] == 0x03 &&
-          flash_target_contents[FLASH_PAGE_SIZE - 4] == 0x04) {
-        for (uint i = 0; i < FLASH_PAGE_SIZE; i++) {
-          save_data[i] = flash_target_contents[i];
+          if (saved) {
+            // compare with the bridge lead; underruns show in the stats
+            printf("saved #%lu in slot %d, %s took %llu us\n",
+                   settings_store.Sequence(), settings_store.Newest(),
+                   erase ? "erase" : "program", time_us_64() - save_us);
+          } else {
+            printf("not saved, settings disabled\n");
+          }
+#else
+          (void)saved;
+#endif
         }
-        param_set_volume((uint16_t)(save_data[SAVE_VOLUME] << 8) +
-                             save_data[SAVE_VOLUME + 1],
-                         distortion, volume_reduce);
-        param_set_bpm(
-            (uint16_t)(save_data[SAVE_BPM] << 8) + save_data[SAVE_BPM + 1],
-            bpm_set, beat_thresh, audio_clk_thresh);
-        // filter_fc = flash_target_contents[SAVE_FILTER];
-        sample_change = save_data[SAVE_SAMPLE];
-        noise_gate_thresh =
-            (uint16_t)(save_data[SAVE_GATE] << 8) + save_data[SAVE_GATE + 1];
-        probability_direction = save_data[SAVE_PROB_DIRECTION];
-        probability_jump = save_data[SAVE_PROB_JUMP];
-        probability_retrig = save_data[SAVE_PROB_RETRIG];
-        probability_gate = save_data[SAVE_PROB_GATE];
-        probability_tunnel = save_data[SAVE_PROB_TUNNEL];
-        sequencer.Load(save_data);
+      }
+      if (clock_ms >= 100 && !boot_loaded) {
+        boot_loaded = true;
+        do_load = true;
+        first_time = true;
+      }
+      if (do_load) {
+        do_load = false;
+        ledarray_load = 16000;
+        debounce_saving = 0;
+#ifdef DEBUG_SAVE
+        printf("\n\n\nPICO_FLASH_SIZE_BYTES: \t%d\n", PICO_FLASH_SIZE_BYTES);
+        printf("SETTINGS_OFFSET: \t%d\n", SETTINGS_OFFSET);
+        printf("FLASH_PAGE_SIZE: \t%d\n", FLASH_PAGE_SIZE);
+        printf("FLASH_SECTOR_SIZE: \t%d\n", FLASH_SECTOR_SIZE);
+        printf("XIP_BASE: \t%d\n", XIP_BASE);
+        printf("settings #%lu in slot %d\n", settings_store.Sequence(),
+               settings_store.Newest());
+        printf("\nloading saved data: \n");
+#endif
+        if (settings_store.Load(save_data)) {
+#ifdef DEBUG_SAVE
+          print_buf(save_data, FLASH_PAGE_SIZE);
+#endif
+          param_set_volume((uint16_t)(save_data[SAVE_VOLUME] << 8) +
+                               save_data[SAVE_VOLUME + 1],
+                           engine.distortion, engine.volume_reduce);
+          param_set_bpm(
+              (uint16_t)(save_data[SAVE_BPM] << 8) + save_data[SAVE_BPM + 1],
+              engine.bpm_set, engine.audio_clk_thresh);
+          // filter_fc = save_data[SAVE_FILTER];
+          engine.sample_change = save_data[SAVE_SAMPLE];
+          engine.noise_gate_thresh =
+              (uint16_t)(save_data[SAVE_GATE] << 8) + save_data[SAVE_GATE + 1];
+          engine.probability_direction = save_data[SAVE_PROB_DIRECTION];
+          engine.probability_jump = save_data[SAVE_PROB_JUMP];
+          engine.probability_retrig = save_data[SAVE_PROB_RETRIG];
+          engine.probability_gate = save_data[SAVE_PROB_GATE];
+          engine.probability_tunnel = save_data[SAVE_PROB_TUNNEL];
+          sequencer.Load(save_data);
 #ifdef DEBUG_SAVE
-        printf("volume_reduce: %d\n", volume_reduce);
-        printf("distortion: %d\n", distortion);
-        printf("bpm_set: %d\n", bpm_set);
-        printf("filter_fc: %d\n", filter_fc);
-        printf("sample_change: %d\n", sample_change);
-        printf("noise_gate_thresh: %d\n", noise_gate_thresh);
-        printf("probability_direction: %d\n", probability_direction);
-        printf("probability_jump: %d\n", probability_jump);
-        printf("probability_retrig: %d\n", probability_retrig);
-        printf("probability_gate: %d\n", probability_gate);
+          printf("volume_reduce: %d\n", engine.volume_reduce);
+          printf("distortion: %d\n", engine.distortion);
+          printf("bpm_set: %d\n", engine.bpm_set);
+          printf("filter_fc: %d\n", engine.filter_fc);
+          printf("sample_change: %d\n", engine.sample_change);
+          printf("noise_gate_thresh: %d\n", engine.noise_gate_thresh);
+          printf("probability_direction: %d\n", engine.probability_direction);
+          printf("probability_jump: %d\n", engine.probability_jump);
+          printf("probability_retrig: %d\n", engine.probability_retrig);
+          printf("probability_gate: %d\n", engine.probability_gate);
 #endif
+        }
       }
+      scheduler.Done(TASK_TICK);
     }
 
-    if (clock_ms % 16 == 0) {  // 250 Hz
+    if (scheduler.Due(TASK_BUTTONS)) {
       // read gpio inputs
       for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
         if (midi_button1 != i && midi_button2 != i) {
@@ -1584,7 +2089,7 @@ int main(void) {
           if (input_button[1].On() && input_button[2].On() &&
               input_button[5].On() && input_button[6].On()) {
             debounce_lock_clock = 80;
-            do_lock_clock = !do_lock_clock;
+            engine.do_lock_clock = !engine.do_lock_clock;
           }
         }
         if (input_button[0].ChangedHigh(true) ||
@@ -1595,10 +2100,11 @@ int main(void) {
               input_button[6].On() && input_button[7].On()) {
             debounce_reset_fx = 80;
             // reset fx
-            param_set_break(0, filter_fc, distortion, probability_jump,
-                            probability_retrig, probability_gate,
-                            probability_direction, probability_tunnel,
-                            save_data);
+            param_set_break(0, engine.filter_fc, engine.distortion,
+                            engine.probability_jump, engine.probability_retrig,
+                            engine.probability_gate,
+                            engine.probability_direction,
+                            engine.probability_tunnel, save_data);
           }
         }
         if (input_button[0].ChangedHigh(true) ||
@@ -1608,7 +2114,7 @@ int main(void) {
           // button combo
           if (input_button[0].On() && input_button[3].On() &&
               input_button[4].On() && input_button[7].On()) {
-            if (do_mute) {
+            if (engine.do_mute) {
               do_start_everything();
             } else {
               do_stop_everything();
@@ -1629,11 +2135,14 @@ int main(void) {
         }
 #endif
       }
+      scheduler.Done(TASK_BUTTONS);
+    }
 
+    if (scheduler.Due(TASK_KNOBS)) {
       // adc reading
       // CRITICAL: Disabled when shift register is enabled (GPIO 27, 28 conflict)
 #if SHIFT_REGISTER_ENABLED == 0
-      if (!btn_retrig) {
+      if (!engine.btn_retrig) {
         for (uint8_t i = 0; i < NUM_KNOBS; i++) {
           input_knob[i].Read();
 
@@ -1694,48 +2203,49 @@ int main(void) {
                 case 0:
                   // sample
                   if (debounce_sample == 0) {
-                    sample_change = input_knob[i].Value() * NUM_SAMPLES /
-                                    input_knob[i].ValueMax();
-                    debounce_sample = 500;
-                    save_data[SAVE_SAMPLE] = sample_change;
+                    engine.sample_change = input_knob[i].Value() * raw_count() /
+                                           input_knob[i].ValueMax();
+                    debounce_sample = 25;  // ms
+                    save_data[SAVE_SAMPLE] = engine.sample_change;
                   }
                   break;
                 case 1:
-                  filter_fc = input_knob[i].Value() * (LPF_MAX + 10) /
-                              input_knob[i].ValueMax();
+                  engine.filter_fc = input_knob[i].Value() * (LPF_MAX + 10) /
+                                     input_knob[i].ValueMax();
                   break;
                 case 2:
                   // gate
                   if (input_knob[i].Value() > 3700) {
-                    noise_gate_thresh = SAMPLES_PER_BEAT * 4;
+                    engine.noise_gate_thresh = SAMPLES_PER_BEAT * 4;
                   } else {
-                    noise_gate_thresh = SAMPLES_PER_BEAT *
-                                        (input_knob[i].Value() * 1000 /
-                                         input_knob[i].ValueMax()) /
-                                        1000;
+                    engine.noise_gate_thresh = SAMPLES_PER_BEAT *
+                                               (input_knob[i].Value() * 1000 /
+                                                input_knob[i].ValueMax()) /
+                                               1000;
                   }
-                  save_data[SAVE_GATE] = (uint8_t)(noise_gate_thresh >> 8);
-                  save_data[SAVE_GATE + 1] = (uint8_t)noise_gate_thresh;
+                  save_data[SAVE_GATE] =
+                      (uint8_t)(engine.noise_gate_thresh >> 8);
+                  save_data[SAVE_GATE + 1] = (uint8_t)engine.noise_gate_thresh;
                   break;
                 case 3:
                   // jump probability
                   if (input_knob[i].Value() < 200) {
-                    probability_jump = 0;
+                    engine.probability_jump = 0;
                   } else {
-                    probability_jump = (input_knob[i].Value() * 254 /
-                                        input_knob[i].ValueMax());
+                    engine.probability_jump = (input_knob[i].Value() * 254 /
+                                               input_knob[i].ValueMax());
                   }
-                  save_data[SAVE_PROB_JUMP] = probability_jump;
+                  save_data[SAVE_PROB_JUMP] = engine.probability_jump;
                   break;
                 case 4:
                   // tunnel probability
                   if (input_knob[i].Value() < 200) {
-                    probability_tunnel = 0;
+                    engine.probability_tunnel = 0;
                   } else {
-                    probability_tunnel = (input_knob[i].Value() * 254 /
-                                          input_knob[i].ValueMax());
+                    engine.probability_tunnel = (input_knob[i].Value() * 254 /
+                                                 input_knob[i].ValueMax());
                   }
-                  save_data[SAVE_PROB_TUNNEL] = probability_tunnel;
+                  save_data[SAVE_PROB_TUNNEL] = engine.probability_tunnel;
                   break;
                 case 5:
                   // sequencer rec
@@ -1753,7 +2263,7 @@ int main(void) {
                   if (input_knob[i].Value() > 2040) {
                     if (!has_saved) {
                       has_saved = true;
-                      debounce_saving = 32000;
+                      debounce_saving = 1600;  // ms
                       debounce_led_save = 255;
                     }
                   } else {
@@ -1766,8 +2276,8 @@ int main(void) {
                       (uint8_t)(input_knob[i].Value() >> 8);
                   save_data[SAVE_VOLUME + 1] = (uint8_t)input_knob[i].Value();
                   ledarray_bar_debounce = 3;  // special volume knob
-                  param_set_volume(input_knob[i].Value(), distortion,
-                                   volume_reduce);
+                  param_set_volume(input_knob[i].Value(), engine.distortion,
+                                   engine.volume_reduce);
 #ifdef DEBUG_KNOB
                   printf("%d: %d; \n", i, input_knob[i].Value());
 #endif
@@ -1795,49 +2305,52 @@ int main(void) {
 
               switch (selector_knob) {
                 case 0:
-                  param_set_break(input_knob[i].Value(), filter_fc, distortion,
-                                  probability_jump, probability_retrig,
-                                  probability_gate, probability_direction,
-                                  probability_tunnel, save_data);
+                  param_set_break(
+                      input_knob[i].Value(), engine.filter_fc,
+                      engine.distortion, engine.probability_jump,
+                      engine.probability_retrig, engine.probability_gate,
+                      engine.probability_direction, engine.probability_tunnel,
+                      save_data);
                   break;
                 case 1:
                   // stretch
                   if (input_knob[i].Value() < 100) {
-                    stretch_change = 0;
+                    engine.stretch_change = 0;
                   } else {
-                    stretch_change = (input_knob[i].Value() * audio_clk_thresh *
-                                      2 / input_knob[i].ValueMax());
+                    engine.stretch_change =
+                        (input_knob[i].Value() * engine.audio_clk_thresh * 2 /
+                         input_knob[i].ValueMax());
                   }
                   break;
                 case 2:
                   // gate probability
                   if (input_knob[i].Value() < 200) {
-                    probability_gate = 0;
+                    engine.probability_gate = 0;
                   } else {
-                    probability_gate = (input_knob[i].Value() * 254 /
-                                        input_knob[i].ValueMax());
+                    engine.probability_gate = (input_knob[i].Value() * 254 /
+                                               input_knob[i].ValueMax());
                   }
-                  save_data[SAVE_PROB_GATE] = probability_direction;
+                  save_data[SAVE_PROB_GATE] = engine.probability_direction;
                   break;
                 case 3:
                   // retrig probability
                   if (input_knob[i].Value() < 200) {
-                    probability_retrig = 0;
+                    engine.probability_retrig = 0;
                   } else {
-                    probability_retrig = (input_knob[i].Value() * 254 /
-                                          input_knob[i].ValueMax());
+                    engine.probability_retrig = (input_knob[i].Value() * 254 /
+                                                 input_knob[i].ValueMax());
                   }
-                  save_data[SAVE_PROB_RETRIG] = probability_jump;
+                  save_data[SAVE_PROB_RETRIG] = engine.probability_jump;
                   break;
                 case 4:
                   // reverse probability
                   if (input_knob[i].Value() < 200) {
-                    probability_direction = 0;
+                    engine.probability_direction = 0;
                   } else {
-                    probability_direction = (input_knob[i].Value() * 254 /
-                                             input_knob[i].ValueMax());
+                    engine.probability_direction =
+                        (input_knob[i].Value() * 254 / input_knob[i].ValueMax());
                   }
-                  save_data[SAVE_PROB_DIRECTION] = probability_direction;
+                  save_data[SAVE_PROB_DIRECTION] = engine.probability_direction;
                   break;
                 case 5:
                   // sequencer on
@@ -1869,15 +2382,15 @@ int main(void) {
                     if (bpm_set_new > 360) {
                       bpm_set_new = 360;
                     }
-                    if (bpm_set_new != bpm_set) {
+                    if (bpm_set_new != engine.bpm_set) {
 #ifdef DEBUG_KNOB
                       printf("%d: %d; \n", i, input_knob[i].Value());
 #endif
                       save_data[SAVE_BPM] = (uint8_t)(bpm_set_new >> 8);
                       save_data[SAVE_BPM + 1] = (uint8_t)bpm_set_new;
 
-                      param_set_bpm(bpm_set_new, bpm_set, beat_thresh,
-                                    audio_clk_thresh);
+                      param_set_bpm(bpm_set_new, engine.bpm_set,
+                                    engine.audio_clk_thresh);
                     }
                   }
                   break;
@@ -1891,81 +2404,55 @@ int main(void) {
       }
 #endif  // SHIFT_REGISTER_ENABLED == 0
       // adc reading end
+      scheduler.Done(TASK_KNOBS);
     }
 
-#if MIDI_IN_ENABLED == 0
-    // trigger in
-    uint8_t clock_pin = 1 - gpio_get(CLOCK_IN_PIN);
-    // code to verify polarity -KEEP
-    // if (clock_pin == 1 && clock_pin_last == 0) {
-    //   printf("[%d] on\n", clock_sync_ms);
-    //   clock_sync_ms = 0;
-    // }
-    // if (clock_pin == 0 && clock_pin_last == 1) {
-    //   printf("[%d] off\n", clock_sync_ms);
-    //   clock_sync_ms = 0;
-    // }
-    if (clock_pin == 1 && clock_pin_last == 0) {
-#ifdef DEBUG_CALIBRATE_PO
-      // this is used for calibration
-      printf("%d\n", clock_sync_ms);
-#endif
-      // DISABLED: External clock sync was blocking internal beat detection
-      // The first iteration with GPIO 2 pull-down triggers false edge, setting
-      // is_syncing=true which permanently blocks beat_counter-based detection
-      // TODO: Initialize clock_pin_last to current GPIO state before main loop
-      /*
-      if (syncing_clicks < 10) {
-        syncing_clicks++;
-        is_syncing = true;
+    if (scheduler.Due(TASK_CLOCK_IN)) {
+#if MIDI_IN_ENABLED == 1
+      while (Onewiremidi_receive(onewiremidi)) {
       }
-      */
-      do_sync_play = true;
-      // this is from a calibration
-      if (clock_sync_ms > 10000) {
-        // out of range of the bpm, but will use to reset system
-        btn_reset = true;
-        clock_hits = 0;
-      } else {
-        bpm_input = 512508000 / ((935 * clock_sync_ms + 31900));
-        ra.Update(bpm_input);
-        bpm_input = ra.Value();
-        if (bpm_input != bpm_set) {
-#ifdef DEBUG_CLOCK
-          printf("%d, %d\n", clock_sync_ms, bpm_input);
+#else
+      // trigger in, edges timestamped by the GPIO interrupt
+      while (clock_in.Next(clock_edge_us)) {
+        uint64_t clock_period_us = clock_edge_us - clock_last_us;
+        clock_last_us = clock_edge_us;
+#ifdef DEBUG_CALIBRATE_PO
+        // this is used for calibration
+        printf("%llu\n", clock_period_us);
 #endif
-          // REDUCE THE BPM INPUT TO ELIMINATE OVERSTEPPING
-          param_set_bpm(bpm_input - 7, bpm_set, beat_thresh, audio_clk_thresh);
+        // DISABLED: External clock sync was blocking internal beat detection
+        // The first iteration with GPIO 2 pull-down triggers false edge,
+        // setting is_syncing=true which permanently blocks beat_counter-based
+        // detection
+        /*
+        if (syncing_clicks < 10) {
+          syncing_clicks++;
+          is_syncing = true;
         }
-        clock_hits++;
-        soft_sync = true;  // TEST
-        if (clock_hits % 16 == 0) {
-          soft_sync = true;
+        */
+        engine.do_sync_play = true;
+        if (clock_period_us > 10000000) {
+          // out of range of the bpm, but will use to reset system
+          engine.btn_reset = true;
+          clock_hits = 0;
+          clock_pll.Reset();
+        } else {
+          clock_hits++;
         }
+        clock_pll.Update(sample_at(clock_edge_us));
+        beat_follow(clock_pll, CLOCK_IN_PPQN, true, false);
+        clock_sync_ms = 0;
+      }
+      if (engine.is_syncing && clock_sync_ms > 10000) {
+        engine.do_sync_play = false;
       }
-      clock_sync_ms = 0;
-    }
-    if (is_syncing && clock_sync_ms > 10000) {
-      do_sync_play = false;
-    }
-    clock_pin_last = clock_pin;
-#endif
-
-    // trig out
-    output_trigger.Update();
-
-#if SHIFT_REGISTER_ENABLED == 1
-    // Display current beat position on shift register LEDs
-    // select_beat advances 0-31 for the amen break, we show (select_beat % 8)
-    // NOTE: Onboard LED is toggled in beat detection (audio_interrupt_handler)
-    // If onboard LED blinks at ~5.5 Hz = beat detection working
-    // If onboard LED stays solid = beat detection NOT firing
-    ledarray.Clear();
-    
-    uint8_t led_index = select_beat % 8;
-    ledarray.Set(led_index, 1000);  // Full brightness
-    
-    ledarray.Update();
 #endif
+      // reset in starts over from the first beat
+      while (reset_in.Next(reset_edge_us)) {
+        engine.btn_reset = true;
+        clock_hits = 0;
+      }
+      scheduler.Done(TASK_CLOCK_IN);
+    }
   }
 }
@@ -4,8 +4,18 @@ target_compile_definitions(${PROJECT_NAME} PRIVATE
     I2S_TEST_SINE=0
     WS2812_ENABLED=0
     MIDI_IN_ENABLED=0
+    USB_MIDI_IN_ENABLED=1
+    MIDI_CLOCK_OUT_ENABLED=1
+    MIDI_UART_OUT_ENABLED=0
+    CLOCK_OUT_ENABLED=0
     MIDI_RESET_EVERY_BEAT=16
     MIDI_CLOCK_MULTIPLIER=2
     MIDI_NOTE_KEY=0
     PCB_V2_LAYOUT=0
+    SAMPLE_BANK_LINKED=1
+    SAMPLE_UPLOAD_ENABLED=1
+    # the audio interrupt divides and multiplies 64-bit values through the
+    # SDK's helpers, which are in flash unless these put them in RAM
+    PICO_DIVIDER_IN_RAM=1
+    PICO_INT64_OPS_IN_RAM=1
 )
\ No newline at end of file
@@ -81,7 +81,11 @@ extern "C" {
 #define CFG_TUD_MSC             0
 #define CFG_TUD_HID             0 
 #define CFG_TUD_MIDI            1 
+#if SAMPLE_UPLOAD_ENABLED == 1
+#define CFG_TUD_VENDOR          1
+#else
 #define CFG_TUD_VENDOR          0
+#endif
 
 // CDC FIFO size of TX and RX
 #define CFG_TUD_CDC_RX_BUFSIZE   64
@@ -91,6 +95,10 @@ extern "C" {
 #define CFG_TUD_MIDI_RX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
 #define CFG_TUD_MIDI_TX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
 
+// Vendor FIFO size of TX and RX (sample bank upload, doth/sample_upload.h)
+#define CFG_TUD_VENDOR_RX_BUFSIZE (TUD_OPT_HIGH_SPEED ? 512 : 256)
+#define CFG_TUD_VENDOR_TX_BUFSIZE 64
+
 #ifdef __cplusplus
 }
 #endif